@@ -2,17 +2,25 @@
 #include <iostream>
 
 
-CubeMarch::CubeMarch(float lim_x, float lim_y, float lim_z, float len, float smoothing_dist, SPH* sph_ptr, float iv, SpatialHash& sh):
+template <typename Search>
+CubeMarch<Search>::CubeMarch(float lim_x, float lim_y, float lim_z, float len, float smoothing_dist, const ParticleStore& ps, float particle_mass, float iv, Search& sh, ThreadPool& tp):
                                                     len_cube(len),
                                                     nx(2 * lim_x / len + 1),
                                                     ny(2 * lim_y / len + 1),
                                                     nz(2 * lim_z / len + 1), 
                                                     cells(nx * ny * nz, CubeCell {}),
-                                                    num_threads(std::thread::hardware_concurrency()),
                                                     h(smoothing_dist),
-                                                    sph(sph_ptr),
+                                                    particles(ps),
+                                                    mass(particle_mass),
+                                                    kernel(MullerKernel::coefficients(smoothing_dist)),
                                                     iso_value(iv), 
-                                                    sp_hash(sh) {
+                                                    sp_hash(sh),
+                                                    pool(tp),
+                                                    local_triangles(tp.size()),
+                                                    last_map_sizes(tp.size(), 0) {
+
+    arenas.reserve(pool.size());
+    for(int c = 0; c < pool.size(); c++) { arenas.emplace_back(1 << 20, main_c::arena_huge_pages); }
 
     glm::vec3 trans(-lim_x, -lim_y, -lim_z);
     glm::mat4 trans_mat = glm::translate(glm::mat4(1.0f), trans);
@@ -28,38 +36,54 @@ CubeMarch::CubeMarch(float lim_x, float lim_y, float lim_z, float len, float smo
     }
 }
 
-void CubeMarch::update_color(std::vector<CubeCell>::iterator begin, std::vector<CubeCell>::iterator end) {
+template <typename Search>
+void CubeMarch<Search>::update_color(std::vector<CubeCell>::iterator begin, std::vector<CubeCell>::iterator end) {
+    const glm::vec3* pos = particles.positions.data();
+    const float* rho = particles.densities.data();
+
     for(auto i = begin; i != end; i++) {
         auto& c = *i;
 
         c.color = 0.0f;
-        for(auto p: c.neighbors) {
-            if(p->density <= 0.001) { continue; }
+        if(neighbor_mode == NeighborMode::stencil) {
+            sp_hash.forEachNeighbor(c.position, [&](uint32_t p) {
+                if(rho[p] <= 0.001) { return; }
 
-            c.color += sph->mass / p->density * sph->poly6(c.position - p->position, h);
+                c.color += mass * particles.mass_scale(p) / rho[p] * MullerKernel::W(kernel, glm::length(c.position - pos[p]));
+            });
+            continue;
         }
-    }
-}
 
-void CubeMarch::update_neighbors(std::vector<CubeCell>::iterator begin, std::vector<CubeCell>::iterator end) {
-    for(auto i = begin; i != end; i++) {
-        auto& c = *i;
+        const size_t q = i - cells.begin();
+        for(uint32_t n = neighbors.begin(q); n < neighbors.end(q); n++) {
+            const uint32_t p = neighbors.indices[n];
+            if(rho[p] <= 0.001) { continue; }
 
-        c.neighbors.clear();
-        sp_hash.queryNeighbors(c.position, c.neighbors);
+            c.color += mass * particles.mass_scale(p) / rho[p] * MullerKernel::W(kernel, neighbors.distances[n]);
+        }
     }
 }
 
-void CubeMarch::load_triangles(const std::vector<Vertex>& loaded_triangles)
+template <typename Search>
+void CubeMarch<Search>::update_neighbors() {
+    const CubeCell* grid = cells.data();
+    neighbors.build(cells.size(), [grid](size_t q) { return grid[q].position; },
+                    particles.positions.data(), sp_hash, h, pool);
+}
+
+template <typename Search>
+void CubeMarch<Search>::load_triangles(const std::vector<Vertex>& loaded_triangles)
 {
     this->triangles = loaded_triangles;
 }
 
-int CubeMarch::cube_index(int i, int j, int k) {
+template <typename Search>
+int CubeMarch<Search>::cube_index(int i, int j, int k) {
     return i * ny * nz + j * nz + k;
 }
 
-glm::vec3 CubeMarch::vertex_interpolation(float iso_value, int p1, int p2) {
+template <typename Search>
+glm::vec3 CubeMarch<Search>::vertex_interpolation(float iso_value, int p1, int p2) {
     const glm::vec3 v1 = cells[p1].position;
     const glm::vec3 v2 = cells[p2].position;
     // std::cout << "idhar" << std::endl;
@@ -85,7 +109,8 @@ glm::vec3 CubeMarch::vertex_interpolation(float iso_value, int p1, int p2) {
 }
 
 // void CubeMarch::march_cubes(int begin, int end, std::vector<glm::vec3>& tris) {
-void CubeMarch::march_cubes(int begin, int end, std::unordered_map<Edge, std::pair<glm::vec3, glm::vec3>, EdgeHash>& local_map_i, std::vector<Edge>& tris) {
+template <typename Search>
+void CubeMarch<Search>::march_cubes(int begin, int end, EdgeMap& local_map_i, std::vector<Edge>& tris) {
     for(int i = begin; i < end; i++){
         for(int j = 0; j < ny - 1; j++){
             for(int k = 0; k < nz - 1; k++){
@@ -163,29 +188,30 @@ void CubeMarch::march_cubes(int begin, int end, std::unordered_map<Edge, std::pa
     }
 }
 
-void CubeMarch::MarchingCubes() {
-    int total = nx - 1;
-    int chunk = (total + num_threads - 1) / num_threads;
-
-    std::vector<std::thread> threads;
-    std::vector<std::vector<Edge>> local_triangles(num_threads, std::vector<Edge>{});
-    std::vector<std::unordered_map<Edge, std::pair<glm::vec3, glm::vec3>, EdgeHash>> local_maps(num_threads, std::unordered_map<Edge, std::pair<glm::vec3, glm::vec3>, EdgeHash>{});
-
-    for(int i = 0; i < num_threads; i++) {
-        int begin = i * chunk;
-        int end = std::min((i + 1) * chunk, total);
+template <typename Search>
+void CubeMarch<Search>::MarchingCubes() {
+    const size_t num_chunks = pool.size();
+    for(auto& a: arenas) { a.reset(); }
+
+    // Maps and the vector holding them come out of the arenas, sized from the last call
+    std::vector<EdgeMap, ArenaAllocator<EdgeMap>> local_maps {ArenaAllocator<EdgeMap>(arenas[0])};
+    local_maps.reserve(num_chunks);
+    for(size_t c = 0; c < num_chunks; c++) {
+        local_maps.emplace_back(last_map_sizes[c], EdgeHash {}, std::equal_to<Edge> {}, EdgeMap::allocator_type(arenas[c]));
+        local_triangles[c].clear();
+    }
 
-        if(begin >= total) { break; }
+    pool.parallel_for(nx - 1, [this, &local_maps](size_t begin, size_t end, size_t chunk) {
+        march_cubes(begin, end, local_maps[chunk], local_triangles[chunk]);
+    });
 
-        threads.emplace_back(
-            [this, begin, end, i, &local_triangles, &local_maps]() {
-                march_cubes(begin, end, local_maps[i], local_triangles[i]);
-            }
-        );
+    size_t total_edges = 0;
+    for(size_t c = 0; c < num_chunks; c++) {
+        last_map_sizes[c] = local_maps[c].size();
+        total_edges += local_maps[c].size();
     }
 
-    for(auto& t: threads) { t.join(); }
-    std::unordered_map<Edge, std::pair<glm::vec3, glm::vec3>, EdgeHash> global_map {};
+    EdgeMap global_map(total_edges, EdgeHash {}, std::equal_to<Edge> {}, EdgeMap::allocator_type(arenas[0]));
     for(auto& local_map_i: local_maps) {
         for(auto& m: local_map_i) {
             Edge e = m.first;
@@ -200,14 +226,12 @@ void CubeMarch::MarchingCubes() {
 
     triangles.clear();
     for(auto& tris: local_triangles) {
-        // triangles.insert(triangles.end(), tris.begin(), tris.end());
-        // triangles.insert()
         for(auto& e: tris){
-            // triangles.push_back()
             auto& e_output = global_map[e];
-            // triangles.push_back(e_output.first);
-            // triangles.push_back(glm::normalize(e_output.second));
             triangles.push_back(Vertex {e_output.first, glm::normalize(e_output.second)});
         }
     }
 }
+
+template class CubeMarch<SpatialHash>;
+template class CubeMarch<NeighborGrid>;
@@ -1,12 +1,12 @@
 #include "CubeMarch.h"
 
 
-int CubeMarch::edgeMap[12][2] = {
+int CubeMarchTables::edgeMap[12][2] = {
     {0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6},
     {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}
 };
 
-int CubeMarch::edgeTable[256] = {
+int CubeMarchTables::edgeTable[256] = {
     0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
     0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
     0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
@@ -40,7 +40,7 @@ int CubeMarch::edgeTable[256] = {
     0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
     0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0   };
 
-int CubeMarch::triTable[256][16] = {
+int CubeMarchTables::triTable[256][16] = {
     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
     {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
     {0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
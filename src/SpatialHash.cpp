@@ -2,14 +2,8 @@
 #include <cmath>
 #include <algorithm>
 
-constexpr uint32_t NO_PARTICLE = 0xFFFFFFFF;
-
 SpatialHash::SpatialHash(float smoothing_dist, uint32_t tableSize)
-    : m_cellSize(smoothing_dist), m_tableSize(tableSize), m_particleTable(nullptr), h(smoothing_dist) {}
-
-SpatialHash::~SpatialHash() {
-    free(m_particleTable);
-}
+    : m_cellSize(smoothing_dist), m_tableSize(tableSize), m_buckets(tableSize), h(smoothing_dist) {}
 
 uint32_t SpatialHash::computeHash(const glm::ivec3& cell) const {
     return ((cell.x * 73856093) ^ 
@@ -25,58 +19,28 @@ glm::ivec3 SpatialHash::positionToCell(const glm::vec3& pos) const {
     };
 }
 
-void SpatialHash::build(std::vector<Particle>& particles) {
-    m_sortedParticles.resize(particles.size());
-    for(size_t i = 0; i < particles.size(); ++i) {
-        m_sortedParticles[i] = &particles[i];
-    }
-
-    std::sort(m_sortedParticles.begin(), m_sortedParticles.end(),
-        [this](const Particle* a, const Particle* b) {
-            return a->hash_value < b->hash_value;
-        });
-
-    m_particleTable = static_cast<uint32_t*>(malloc(m_tableSize * sizeof(uint32_t)));
-    std::fill_n(m_particleTable, m_tableSize, NO_PARTICLE);
-
-    uint32_t prevHash = NO_PARTICLE;
-    for(uint32_t i = 0; i < m_sortedParticles.size(); ++i) {
-        const uint32_t currentHash = m_sortedParticles[i]->hash_value;
-        
-        if(currentHash != prevHash) {
-            m_particleTable[currentHash] = i;
-            prevHash = currentHash;
-        }
-    }
-
-    m_sortedParticlesC.resize(particles.size());
-    for(size_t i = 0; i < particles.size(); ++i) {
-        m_sortedParticlesC[i] = *m_sortedParticles[i];
-    }
+void SpatialHash::build(const ParticleStore& particles, ThreadPool& pool) {
+    m_buckets.build(particles.hash_values.data(), particles.size(), pool);
 }
 
 void SpatialHash::queryNeighbors(
-    glm::vec3 pos, std::vector<Particle*>& neighbors)
+    glm::vec3 pos, std::vector<uint32_t>& neighbors) const
 {
     float radius = h;
 
     const glm::ivec3 baseCell = positionToCell(pos);
     const int searchRadius = static_cast<int>(std::ceil(radius / m_cellSize));
+    std::vector<uint32_t> seen;
 
     for(int dx = -searchRadius; dx <= searchRadius; ++dx) {
         for(int dy = -searchRadius; dy <= searchRadius; ++dy) {
             for(int dz = -searchRadius; dz <= searchRadius; ++dz) {
                 const glm::ivec3 cell = baseCell + glm::ivec3(dx, dy, dz);
                 const uint32_t hash = computeHash(cell);
+                if(std::find(seen.begin(), seen.end(), hash) != seen.end()) continue;
 
-                if(m_particleTable[hash] == NO_PARTICLE) continue;
-
-                uint32_t i = m_particleTable[hash];
-                while(i < m_sortedParticlesC.size() && m_sortedParticlesC[i].hash_value == hash) {
-                    neighbors.push_back(&m_sortedParticlesC[i]);
-
-                    ++i;
-                }
+                seen.push_back(hash);
+                m_buckets.forEach(hash, hash, [&](uint32_t i) { neighbors.push_back(i); });
             }
         }
     }
@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <new>
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+static constexpr size_t huge_page_size = 2 << 20;
+
+Arena::Arena(size_t initial_size, bool use_huge_pages): huge_pages(use_huge_pages) {
+    add_block(initial_size);
+}
+
+Arena::Arena(Arena&& other) noexcept
+    : blocks(std::move(other.blocks)), offset(other.offset), huge_pages(other.huge_pages) {
+    other.blocks.clear();
+}
+
+Arena::~Arena() {
+    for(auto& b: blocks) { release(b); }
+}
+
+void Arena::add_block(size_t size) {
+    Block block {nullptr, size, false};
+
+#ifdef __linux__
+    // Huge pages are a hint, fall back to regular pages when the kernel has none to give
+    if(huge_pages) {
+        block.size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+        void* p = mmap(nullptr, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p != MAP_FAILED) {
+            madvise(p, block.size, MADV_HUGEPAGE);
+            block.data = static_cast<char*>(p);
+            block.mapped = true;
+        }
+    }
+#endif
+
+    if(!block.data) {
+        block.data = static_cast<char*>(::operator new(block.size, std::align_val_t(64)));
+    }
+
+    blocks.push_back(block);
+    offset = 0;
+}
+
+void Arena::release(Block& block) {
+#ifdef __linux__
+    if(block.mapped) {
+        munmap(block.data, block.size);
+        return;
+    }
+#endif
+    ::operator delete(block.data, std::align_val_t(64));
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment) {
+    size_t start = (offset + alignment - 1) & ~(alignment - 1);
+
+    if(start + bytes > blocks.back().size) {
+        add_block(std::max(bytes + alignment, 2 * blocks.back().size));
+        start = 0;
+    }
+
+    offset = start + bytes;
+    return blocks.back().data + start;
+}
+
+void Arena::reset() {
+    // Overflowed last frame: replace the chain by a single block that fits it
+    if(blocks.size() > 1) {
+        const size_t size = capacity();
+        for(auto& b: blocks) { release(b); }
+        blocks.clear();
+        add_block(size);
+    }
+
+    offset = 0;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for(const auto& b: blocks) { total += b.size; }
+    return total;
+}
@@ -0,0 +1,177 @@
+#include "batch.h"
+
+#include <iostream>
+#include <thread>
+
+#include "alloc_counter.h"
+#include "bounded_queue.h"
+#include "frame.h"
+#include "sph_consts.h"
+
+using namespace main_c;
+
+Scene::Scene(ThreadPool& pool, const std::string& solver, bool marching_cubes):
+    search(make_neighbor_search<SelectedSearch>(h + sph_c::neighbor_skin, lim_x, lim_y, lim_z)),
+    sph(h, lim_x, lim_y, lim_z, sprite_size, search, pool) {
+
+    if(solver == "pbf") { sph.set_solver(Solver::pbf); }
+    else if(solver == "wcsph") { sph.set_solver(Solver::wcsph); }
+
+    std::cout << "SPH kernels: " << SelectedKernel::name << ", " << sph_simd::name(sph.simd_isa)
+              << ", neighbor search: " << SelectedSearch::name
+              << ", solver: " << (sph.solver == Solver::pbf ? "pbf" : "wcsph") << std::endl;
+
+    // sph.initialize_particles_sphere(sphere_count, sphere_center, sphere_radius);
+    sph.initialize_particles_cube(cube_center, cube_side_length, cube_spacing);
+    sph.create_container();
+
+    if(marching_cubes) {
+        cm.reset(new SurfaceMesh{2*lim_x, 2*lim_y, 2*lim_z, len_cube, cm_h, sph.particles, sph.mass, iso_value, search, pool});
+        cm->neighbor_mode = sph.neighbor_mode;
+    }
+}
+
+void check_allocations(const char* phase, int frame, uint64_t count_before) {
+    const uint64_t allocations = alloc_counter::count() - count_before;
+    if(alloc_warmup_frames >= 0 && frame >= alloc_warmup_frames && allocations > 0) {
+        std::cerr << phase << " made " << allocations << " heap allocations in frame " << frame << std::endl;
+    }
+}
+
+void step_frame(Scene& scene, DomainDecomposition* domain, int sim_frame, bool alloc_checks) {
+    Simulation& sph = scene.sph;
+    const uint64_t step_allocations = alloc_counter::count();
+
+    if(domain) { domain->advance_frame(sph); }
+    else { sph.advance_frame(); }
+
+    if(scene.cm) {
+        // Pair distances are cached, so gather neighbors at the post-step positions
+        if(sph.neighbor_mode == NeighborMode::lists) { scene.cm->update_neighbors(); }
+        scene.cm->parallel(&SurfaceMesh::update_color);
+    }
+
+    if(alloc_checks) { check_allocations("Simulation step", sim_frame, step_allocations); }
+
+    if(numa_aware && numa_report_interval > 0 && (sim_frame + 1) % numa_report_interval == 0) {
+        const NumaTraffic traffic = sph.numa_traffic();
+        std::cout << "NUMA: " << traffic.remote_reads << " of " << traffic.reads << " neighbor reads cross nodes, ~"
+                  << traffic.remote_bytes / 1024 << " KiB per substep" << std::endl;
+    }
+}
+
+// A frame on its way through the save pipeline, the packets are recycled so their buffers
+// keep their capacity
+struct FramePacket {
+    int frame = 0;
+    FrameHeader header;
+    std::vector<Particle_buffer> particles;
+    std::vector<CubeCell> cells;    // Color field of the frame, marched by the mesh stage
+    std::vector<Vertex> triangles;
+};
+
+// Stage 1 (this thread) steps the simulation and snapshots the particles and the color field
+// into a free packet, stage 2 marches the cubes, stage 3 writes the file and frees the packet.
+// The mesh stage has its own SurfaceMesh: cell arrays are swapped in and out of packets, so the
+// simulation refills one color field while another is marched. It also has its own thread pool
+// as wide as the simulation's, so the two stages' parallel_for jobs run at the same time and the
+// OS gives the cores one stage leaves idle to the other. A stage that fails closes free_packets,
+// which ends the simulation once the packets in flight are used up.
+static void run_save_pipeline(Scene& scene, DomainDecomposition* domain, const Camera& cam, const std::string& prefix) {
+    Simulation& sph = scene.sph;
+    const size_t depth = std::max(pipeline_depth, 1);
+
+    std::vector<FramePacket> packets(depth);
+    BoundedQueue<FramePacket*> free_packets(depth);
+    BoundedQueue<FramePacket*> to_mesh(depth);
+    BoundedQueue<FramePacket*> to_write(depth);
+    for(FramePacket& packet: packets) {
+        if(scene.cm) { packet.cells = scene.cm->cells; }
+        free_packets.push(&packet);
+    }
+
+    std::unique_ptr<ThreadPool> mesh_pool;
+    std::unique_ptr<SurfaceMesh> mesher;
+    if(scene.cm) {
+        mesh_pool.reset(new ThreadPool(sph.pool.size()));
+        mesher.reset(new SurfaceMesh{2*lim_x, 2*lim_y, 2*lim_z, len_cube, cm_h, sph.particles, sph.mass, iso_value, scene.search, *mesh_pool});
+    }
+
+    std::thread mesh_stage([&] {
+        FramePacket* packet = nullptr;
+        try {
+            while(to_mesh.pop(packet)) {
+                if(mesher) {
+                    std::swap(mesher->cells, packet->cells);
+                    mesher->MarchingCubes();
+                    std::swap(mesher->cells, packet->cells);
+                    std::swap(mesher->triangles, packet->triangles);
+                    packet->header.triangle_count = static_cast<uint32_t>(packet->triangles.size());
+                }
+                to_write.push(packet);
+            }
+        } catch(const std::exception& e) {
+            std::cerr << "Marching cubes failed: " << e.what() << std::endl;
+            free_packets.close();
+        }
+        to_write.close();
+    });
+
+    std::thread write_stage([&] {
+        FramePacket* packet = nullptr;
+        try {
+            FrameWriter writer(prefix);
+            while(to_write.pop(packet)) {
+                writer.write(packet->frame, packet->header, packet->particles, packet->triangles);
+                free_packets.push(packet);
+            }
+        } catch(const std::exception& e) {
+            std::cerr << "Writing frames failed: " << e.what() << std::endl;
+            free_packets.close();
+        }
+    });
+
+    for(int frame = 0; frame <= max_frames; frame++) {
+        std::cout << max_frames - frame - 1 << std::endl;
+        step_frame(scene, domain, frame, /*alloc_checks=*/false);
+
+        FramePacket* packet = nullptr;
+        if(!free_packets.pop(packet)) { break; }
+        packet->frame = frame;
+        capture_frame(sph, cam, packet->header, packet->particles);
+        if(scene.cm) { std::swap(scene.cm->cells, packet->cells); }
+        to_mesh.push(packet);
+    }
+
+    to_mesh.close();
+    mesh_stage.join();
+    write_stage.join();
+}
+
+void run_save_mode(Scene& scene, DomainDecomposition* domain, const Camera& cam, const std::string& prefix) {
+    if(save_pipeline) {
+        run_save_pipeline(scene, domain, cam, prefix);
+        return;
+    }
+
+    static const std::vector<Vertex> no_triangles;
+    FrameWriter writer(prefix);
+    FrameHeader header;
+    std::vector<Particle_buffer> records;
+
+    for(int frame = 0; frame <= max_frames; frame++) {
+        std::cout << max_frames - frame - 1 << std::endl;
+        step_frame(scene, domain, frame);
+
+        if(scene.cm) {
+            const uint64_t mesh_allocations = alloc_counter::count();
+            scene.cm->MarchingCubes();
+            check_allocations("Marching cubes", frame + 1, mesh_allocations);
+        }
+
+        const std::vector<Vertex>& triangles = scene.cm ? scene.cm->triangles : no_triangles;
+        capture_frame(scene.sph, cam, header, records);
+        header.triangle_count = static_cast<uint32_t>(triangles.size());
+        writer.write(frame, header, records, triangles);
+    }
+}
@@ -0,0 +1,59 @@
+#include "cell_buckets.h"
+
+CellBuckets::CellBuckets(uint32_t bucketCount)
+    : m_bucketCount(bucketCount), m_start(bucketCount, 0), m_end(bucketCount, 0),
+      m_cursor(new std::atomic<uint32_t>[bucketCount]) {}
+
+void CellBuckets::build(const uint32_t* keys, size_t count, ThreadPool& pool) {
+    m_sorted.resize(count);
+    m_chunkSums.assign(pool.size() + 1, 0);
+
+    pool.parallel_for(m_bucketCount, [this](size_t begin, size_t end) {
+        for(size_t b = begin; b < end; b++) { m_cursor[b].store(0, std::memory_order_relaxed); }
+    });
+
+    pool.parallel_for(count, [this, keys](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) { m_cursor[keys[i]].fetch_add(1, std::memory_order_relaxed); }
+    });
+
+    // Exclusive prefix sum over the buckets: per-chunk totals, then a serial scan over the chunks
+    pool.parallel_for(m_bucketCount, [this](size_t begin, size_t end, size_t chunk) {
+        uint32_t sum = 0;
+        for(size_t b = begin; b < end; b++) { sum += m_cursor[b].load(std::memory_order_relaxed); }
+        m_chunkSums[chunk + 1] = sum;
+    });
+
+    for(size_t c = 0; c + 1 < m_chunkSums.size(); c++) { m_chunkSums[c + 1] += m_chunkSums[c]; }
+
+    pool.parallel_for(m_bucketCount, [this](size_t begin, size_t end, size_t chunk) {
+        uint32_t running = m_chunkSums[chunk];
+        for(size_t b = begin; b < end; b++) {
+            const uint32_t n = m_cursor[b].load(std::memory_order_relaxed);
+            m_start[b] = running;
+            m_end[b] = running + n;
+            m_cursor[b].store(running, std::memory_order_relaxed);
+            running += n;
+        }
+    });
+
+    pool.parallel_for(count, [this, keys](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            m_sorted[m_cursor[keys[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+        }
+    });
+
+    // The scatter order inside a bucket depends on thread timing, sort it back to index
+    // order so neighbor sums come out the same every run. Buckets hold a handful of particles.
+    pool.parallel_for(m_bucketCount, [this](size_t begin, size_t end) {
+        for(size_t b = begin; b < end; b++) {
+            uint32_t* first = m_sorted.data() + m_start[b];
+            uint32_t* last = m_sorted.data() + m_end[b];
+            for(uint32_t* i = first + 1; i < last; i++) {
+                const uint32_t v = *i;
+                uint32_t* j = i;
+                for(; j > first && *(j - 1) > v; j--) { *j = *(j - 1); }
+                *j = v;
+            }
+        }
+    });
+}
@@ -0,0 +1,343 @@
+#include "domain_decomposition.h"
+
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#include "neighbor_search.h"
+#include "sph_consts.h"
+
+#ifdef __linux__
+#include <csignal>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#endif
+
+void SharedBarrier::wait(uint32_t parties, const std::atomic<uint32_t>& failed) {
+    const uint32_t gen = generation.load(std::memory_order_acquire);
+
+    if(arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == parties) {
+        arrived.store(0, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+        return;
+    }
+
+    while(generation.load(std::memory_order_acquire) == gen) {
+        if(failed.load(std::memory_order_relaxed)) { throw std::runtime_error("A domain worker failed"); }
+        std::this_thread::yield();
+    }
+}
+
+#ifdef __linux__
+
+// One worker process: its slab [x0, x1) of the tank and a full single-process solver over the
+// particles it owns, followed by halo copies of its neighbors' particles
+struct DomainDecomposition::Worker {
+    DomainDecomposition& domain;
+    const int rank;
+    float x0;
+    float x1;
+    const float halo = 2.0f * main_c::h;
+
+    ThreadPool pool;
+    SelectedSearch search;
+    Simulation sph;
+
+    // Outgoing migrants and halo copies per side, migrants are also kept as halo copies here
+    std::vector<DomainParticle> migrants[2];
+    std::vector<DomainParticle> halo_out[2];
+
+    Worker(DomainDecomposition& d, int r, int threads)
+        : domain(d), rank(r), pool(threads, false),
+          search(make_neighbor_search<SelectedSearch>(main_c::h + sph_c::neighbor_skin, main_c::lim_x, main_c::lim_y, main_c::lim_z)),
+          sph(main_c::h, main_c::lim_x, main_c::lim_y, main_c::lim_z, main_c::sprite_size, search, pool) {
+
+        const float width = 2.0f * main_c::lim_x / domain.ranks;
+        const float inf = std::numeric_limits<float>::infinity();
+        x0 = (rank == 0) ? -inf : -main_c::lim_x + rank * width;
+        x1 = (rank == domain.ranks - 1) ? inf : -main_c::lim_x + (rank + 1) * width;
+
+        sph.integrator = Integrator::symplectic_euler;
+        sph.set_solver(Solver::wcsph);
+    }
+
+    DomainParticle record(size_t i) const {
+        const ParticleStore& p = sph.particles;
+        return {p.positions[i], p.velocities[i], p.colors[i], p.densities[i], p.pressures[i], p.ids[i]};
+    }
+
+    void append(const DomainParticle* src, size_t count) {
+        ParticleStore& p = sph.particles;
+        const size_t n = p.size();
+        p.for_each_array([n, count](auto& a) { a.resize(n + count); });
+
+        for(size_t k = 0; k < count; k++) {
+            const DomainParticle& d = src[k];
+            p.positions[n + k] = d.position;
+            p.velocities[n + k] = d.velocity;
+            p.colors[n + k] = d.color;
+            p.accelerations[n + k] = glm::vec3(0.0f);
+            p.densities[n + k] = d.density;
+            p.pressures[n + k] = d.pressure;
+            p.ids[n + k] = d.id;
+            p.levels[n + k] = 0;
+        }
+    }
+
+    void drop_halo() {
+        const size_t owned = sph.owned_count();
+        sph.particles.for_each_array([owned](auto& a) { a.resize(owned); });
+        sph.halo_count = 0;
+    }
+
+    // Moves particle i to slot kept in every array
+    void keep(size_t i, size_t kept) {
+        if(i != kept) { sph.particles.for_each_array([i, kept](auto& a) { a[kept] = a[i]; }); }
+    }
+
+    // Builds the whole scene like a single process would and keeps the particles in this slab
+    void initialize() {
+        sph.initialize_particles_cube(main_c::cube_center, main_c::cube_side_length, main_c::cube_spacing);
+
+        size_t kept = 0;
+        for(size_t i = 0; i < sph.particles.size(); i++) {
+            const float x = sph.particles.positions[i].x;
+            if(x < x0 || x >= x1) { continue; }
+            keep(i, kept++);
+        }
+
+        sph.particles.for_each_array([kept](auto& a) { a.resize(kept); });
+        sph.particles_changed();
+    }
+
+    // Hands particles that left the slab to the neighbor they moved into, then rebuilds the
+    // halo from both neighbors' copies and this worker's own migrants
+    void exchange() {
+        drop_halo();
+
+        for(int side = 0; side < 2; side++) {
+            migrants[side].clear();
+            halo_out[side].clear();
+        }
+
+        const size_t owned = sph.particles.size();
+        size_t kept = 0;
+        for(size_t i = 0; i < owned; i++) {
+            const float x = sph.particles.positions[i].x;
+            if(x < x0 || x >= x1) {
+                migrants[x < x0 ? 0 : 1].push_back(record(i));
+                continue;
+            }
+
+            keep(i, kept);
+            if(x < x0 + halo) { halo_out[0].push_back(record(kept)); }
+            if(x >= x1 - halo) { halo_out[1].push_back(record(kept)); }
+            kept++;
+        }
+        sph.particles.for_each_array([kept](auto& a) { a.resize(kept); });
+
+        for(int side = 0; side < 2; side++) {
+            Mailbox& box = domain.outbox(rank, side);
+            std::copy(migrants[side].begin(), migrants[side].end(), box.data);
+            std::copy(halo_out[side].begin(), halo_out[side].end(), box.data + migrants[side].size());
+            box.migrants = migrants[side].size();
+            box.halo = halo_out[side].size();
+        }
+
+        domain.control->step_barrier.wait(domain.ranks, domain.control->failed);
+
+        const Mailbox* inbox[2] = {
+            rank > 0 ? &domain.outbox(rank - 1, 1) : nullptr,
+            rank < domain.ranks - 1 ? &domain.outbox(rank + 1, 0) : nullptr,
+        };
+
+        for(const Mailbox* box : inbox) {
+            if(box) { append(box->data, box->migrants); }
+        }
+
+        const size_t first_halo = sph.particles.size();
+        for(const Mailbox* box : inbox) {
+            if(box) { append(box->data + box->migrants, box->halo); }
+        }
+
+        for(int side = 0; side < 2; side++) {
+            for(const DomainParticle& d : migrants[side]) {
+                if(d.position.x >= x0 - halo && d.position.x < x1 + halo) { append(&d, 1); }
+            }
+        }
+
+        sph.halo_count = sph.particles.size() - first_halo;
+        sph.particles_changed();
+    }
+
+    // SPH::advance_frame with a halo exchange before every force evaluation and the
+    // time step limit taken over all workers, so every worker takes the same substeps
+    void advance_frame() {
+        const double frame_end = static_cast<double>(++sph.frames_advanced) * sph.delta_time;
+
+        while(sph.time < frame_end - 1e-4 * sph.delta_time) {
+            exchange();
+            sph.compute_forces();
+
+            domain.limits[rank] = sph.time_step_limit();
+            domain.control->step_barrier.wait(domain.ranks, domain.control->failed);
+            const float dt = *std::min_element(domain.limits, domain.limits + domain.ranks);
+
+            sph.parallel(&Simulation::update_state, dt);
+            sph.parallel(&Simulation::boundary_conditions);
+            sph.time += dt;
+        }
+
+        drop_halo();
+        if(rank == 0) { domain.control->time = sph.time; }
+    }
+
+    void publish_frame() {
+        DomainParticle* out = domain.gathered(rank);
+        for(size_t i = 0; i < sph.particles.size(); i++) { out[i] = record(i); }
+        domain.gather_counts[rank] = sph.particles.size();
+    }
+
+    void run() {
+        initialize();
+
+        while(true) {
+            domain.control->frame_barrier.wait(domain.ranks + 1, domain.control->failed);
+            if(domain.control->stop.load()) { return; }
+
+            advance_frame();
+            publish_frame();
+            domain.control->frame_barrier.wait(domain.ranks + 1, domain.control->failed);
+        }
+    }
+};
+
+int DomainDecomposition::run_worker(int rank) {
+    const int hardware = std::max(1u, std::thread::hardware_concurrency());
+    const int threads = std::max(1, (main_c::num_threads > 0 ? main_c::num_threads : hardware) / ranks);
+
+    Worker worker(*this, rank, threads);
+    worker.run();
+    return 0;
+}
+
+DomainDecomposition::DomainDecomposition(int processes, size_t particle_count): capacity(particle_count) {
+    // A slab must be at least as wide as the halo, so halos and migrants only reach the next slab
+    const int max_ranks = std::max(1, static_cast<int>(main_c::lim_x / main_c::h));
+    ranks = std::clamp(processes, 1, max_ranks);
+    if(ranks != processes) {
+        std::cerr << "Tank fits at most " << max_ranks << " slabs, using " << ranks << " processes" << std::endl;
+    }
+
+    // Every buffer starts on its own cache line
+    const auto carve = [this](size_t bytes) {
+        const size_t offset = shared_size;
+        shared_size += (bytes + 63) & ~size_t(63);
+        return offset;
+    };
+    const size_t control_at = carve(sizeof(Control));
+    const size_t limits_at = carve(ranks * sizeof(float));
+    const size_t mailboxes_at = carve(2 * ranks * sizeof(Mailbox));
+    const size_t mail_data_at = carve(2 * ranks * capacity * sizeof(DomainParticle));
+    const size_t gather_counts_at = carve(ranks * sizeof(uint32_t));
+    const size_t gather_at = carve(ranks * capacity * sizeof(DomainParticle));
+
+    // Pages are only backed once touched, the worst-case capacity costs address space only
+    shared = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared == MAP_FAILED) { throw std::runtime_error("Can't map shared memory for the domain workers"); }
+
+    char* base = static_cast<char*>(shared);
+    control = new (base + control_at) Control();
+    limits = reinterpret_cast<float*>(base + limits_at);
+    mailboxes = reinterpret_cast<Mailbox*>(base + mailboxes_at);
+    gather_counts = reinterpret_cast<uint32_t*>(base + gather_counts_at);
+    gather = reinterpret_cast<DomainParticle*>(base + gather_at);
+
+    DomainParticle* mail_data = reinterpret_cast<DomainParticle*>(base + mail_data_at);
+    for(int m = 0; m < 2 * ranks; m++) { mailboxes[m] = {0, 0, mail_data + m * capacity}; }
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    for(int rank = 0; rank < ranks; rank++) {
+        const pid_t pid = fork();
+        if(pid < 0) {
+            control->failed = 1;
+            throw std::runtime_error("Can't fork a domain worker");
+        }
+
+        if(pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+            int status = 1;
+            try {
+                status = run_worker(rank);
+            } catch(const std::exception& e) {
+                std::cerr << "Domain worker " << rank << ": " << e.what() << std::endl;
+            }
+
+            if(status != 0) { control->failed = 1; }
+            _exit(status);
+        }
+
+        workers.push_back(pid);
+    }
+}
+
+DomainDecomposition::~DomainDecomposition() {
+    control->stop = 1;
+
+    try {
+        if(!control->failed) { control->frame_barrier.wait(ranks + 1, control->failed); }
+    } catch(const std::exception&) {}
+
+    for(int pid : workers) {
+        if(control->failed) { kill(pid, SIGTERM); }
+        waitpid(pid, nullptr, 0);
+    }
+
+    munmap(shared, shared_size);
+}
+
+void DomainDecomposition::advance_frame(Simulation& sph) {
+    control->frame_barrier.wait(ranks + 1, control->failed);
+    control->frame_barrier.wait(ranks + 1, control->failed);
+
+    // Coordinator particles are never reordered, so slot i holds creation index i
+    ParticleStore& p = sph.particles;
+    for(int rank = 0; rank < ranks; rank++) {
+        const DomainParticle* records = gathered(rank);
+        for(uint32_t k = 0; k < gather_counts[rank]; k++) {
+            const DomainParticle& d = records[k];
+            p.positions[d.id] = d.position;
+            p.velocities[d.id] = d.velocity;
+            p.colors[d.id] = d.color;
+            p.densities[d.id] = d.density;
+            p.pressures[d.id] = d.pressure;
+        }
+    }
+
+    sph.time = control->time;
+    sph.frames_advanced++;
+
+    sph.parallel(&Simulation::update_hash);
+    sph.sp_hash.build(p, sph.pool);
+}
+
+#else
+
+DomainDecomposition::DomainDecomposition(int, size_t) {
+    throw std::runtime_error("Multi-process runs need Linux");
+}
+
+DomainDecomposition::~DomainDecomposition() {}
+
+void DomainDecomposition::advance_frame(Simulation&) {}
+
+#endif
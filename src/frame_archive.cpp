@@ -0,0 +1,173 @@
+#include "frame_archive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static constexpr uint64_t frame_alignment = 8;
+
+FrameArchiveWriter::FrameArchiveWriter(const std::string& filename): out(filename, std::ios::binary) {
+    if(!out) { throw std::runtime_error("Can't create " + filename); }
+
+    const FrameArchiveHeader header;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset = sizeof(header);
+}
+
+void FrameArchiveWriter::append(uint32_t frame_number, const uint8_t* frame, size_t size) {
+    if(!out.is_open()) { return; }
+
+    const FrameHeader& header = *reinterpret_cast<const FrameHeader*>(frame);
+    index.push_back({frame_number, frame_keyframe(frame, size, frame_number), offset, size, header.timestamp});
+
+    static const char padding[frame_alignment] = {};
+    const uint64_t padded = (size + frame_alignment - 1) / frame_alignment * frame_alignment;
+    out.write(reinterpret_cast<const char*>(frame), size);
+    out.write(padding, padded - size);
+    offset += padded;
+}
+
+void FrameArchiveWriter::finish() {
+    if(!out.is_open()) { return; }
+
+    FrameArchiveTrailer trailer;
+    trailer.index_offset = offset;
+    trailer.frame_count = index.size();
+    out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(FrameIndexEntry));
+    out.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+    out.close();
+}
+
+FrameArchive::FrameArchive(const std::string& filename) {
+#ifdef __linux__
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) { throw std::runtime_error("Can't open " + filename); }
+
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p != MAP_FAILED) {
+            data = static_cast<const uint8_t*>(p);
+            length = st.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+#endif
+
+    if(!mapped) {
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if(!in) { throw std::runtime_error("Can't open " + filename); }
+        contents.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(reinterpret_cast<char*>(contents.data()), contents.size());
+        data = contents.data();
+        length = contents.size();
+    }
+
+    if(length < sizeof(FrameArchiveHeader) || std::memcmp(data, FrameArchiveHeader().magic, 4) != 0) {
+        release();
+        throw std::runtime_error(filename + " is not a frame archive");
+    }
+
+    FrameArchiveTrailer trailer;
+    const bool indexed = length >= sizeof(FrameArchiveHeader) + sizeof(FrameArchiveTrailer);
+    if(indexed) { std::memcpy(&trailer, data + length - sizeof(trailer), sizeof(trailer)); }
+
+    const uint64_t index_end = length - sizeof(FrameArchiveTrailer);
+    if(indexed && std::memcmp(trailer.magic, FrameArchiveTrailer().magic, 4) == 0 &&
+       trailer.index_offset <= index_end && index_end - trailer.index_offset == trailer.frame_count * sizeof(FrameIndexEntry)) {
+        index = reinterpret_cast<const FrameIndexEntry*>(data + trailer.index_offset);
+        count = trailer.frame_count;
+    }
+    else {
+        recover_index();
+        std::cerr << filename << " has no index, recovered " << count << " frames" << std::endl;
+    }
+}
+
+FrameArchive::~FrameArchive() {
+    release();
+}
+
+void FrameArchive::release() {
+#ifdef __linux__
+    if(mapped) {
+        munmap(const_cast<uint8_t*>(data), length);
+        mapped = false;
+    }
+#endif
+}
+
+void FrameArchive::recover_index() {
+    recovered.clear();
+    uint64_t offset = sizeof(FrameArchiveHeader);
+    uint32_t frame_number = 0;
+    while(offset < length) {
+        const size_t size = frame_bytes(data + offset, length - offset);
+        if(size == 0) { break; }
+
+        const FrameHeader& header = *reinterpret_cast<const FrameHeader*>(data + offset);
+        recovered.push_back({frame_number, frame_keyframe(data + offset, size, frame_number), offset, size, header.timestamp});
+
+        offset += (size + frame_alignment - 1) / frame_alignment * frame_alignment;
+        frame_number = static_cast<uint32_t>(recovered.size());
+    }
+
+    index = recovered.data();
+    count = recovered.size();
+}
+
+size_t FrameArchive::find(uint32_t frame_number) const {
+    const FrameIndexEntry* end = index + count;
+    const FrameIndexEntry* it = std::lower_bound(index, end, frame_number,
+        [](const FrameIndexEntry& e, uint32_t n) { return e.frame < n; });
+    return (it != end && it->frame == frame_number) ? static_cast<size_t>(it - index) : count;
+}
+
+size_t FrameArchive::seek(double timestamp) const {
+    const FrameIndexEntry* end = index + count;
+    const FrameIndexEntry* it = std::upper_bound(index, end, timestamp,
+        [](double t, const FrameIndexEntry& e) { return t < e.timestamp; });
+    return it == index ? 0 : static_cast<size_t>(it - index) - 1;
+}
+
+const Vertex* FrameArchive::raw_triangles(size_t i) const {
+    const FrameHeader& h = header(i);
+    if(h.triangle_count == 0) { return nullptr; }
+    if(h.version == 4) {
+        return reinterpret_cast<const Vertex*>(bytes(i) + sizeof(FrameHeader) + h.particle_count * sizeof(Particle_buffer));
+    }
+
+    FrameChannelDesc desc;
+    const uint8_t* triangles = frame_channel(bytes(i), index[i].size, frame_triangles, &desc);
+    const bool vertices = triangles && desc.type == ChannelType::f32 && desc.width == sizeof(float) && desc.count == 6 &&
+                          desc.elements == h.triangle_count;
+    return vertices ? reinterpret_cast<const Vertex*>(triangles) : nullptr;
+}
+
+FrameData FrameArchive::load(size_t i, bool load_cube_marching) {
+    FrameData frame;
+    load(i, frame, load_cube_marching);
+    return frame;
+}
+
+void FrameArchive::load(size_t i, FrameData& frame, bool load_cube_marching) {
+    if(i >= count) { throw std::out_of_range("Frame " + std::to_string(i) + " is past the end of the archive"); }
+
+    const FrameIndexEntry& e = index[i];
+    if(e.keyframe != e.frame && !reader.has_keyframe(e.keyframe)) {
+        const size_t key = find(e.keyframe);
+        if(key == count) { throw std::runtime_error("Keyframe " + std::to_string(e.keyframe) + " is missing from the archive"); }
+        reader.decode(bytes(key), index[key].size, frame, false);
+    }
+    reader.decode(bytes(i), e.size, frame, load_cube_marching);
+}
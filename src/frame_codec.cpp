@@ -0,0 +1,263 @@
+#include "frame_codec.h"
+#include "frame.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "lz.h"
+#include "sph_consts.h"
+
+// IEEE half floats, rounded to nearest. Values past the half range become infinity and ones
+// below its normal range flush to zero, neither occurs for the simulated quantities.
+static uint16_t to_half(float value) {
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    const int exponent = static_cast<int>((f >> 23) & 0xff) - 127 + 15;
+    const uint32_t mantissa = f & 0x7fffff;
+
+    if(((f >> 23) & 0xff) == 0xff) { return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0)); }
+    if(exponent <= 0) { return static_cast<uint16_t>(sign); }
+    if(exponent >= 31) { return static_cast<uint16_t>(sign | 0x7c00); }
+
+    // Round to nearest, a carry out of the mantissa correctly bumps the exponent
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    if((mantissa & 0x1fff) > 0x1000 || ((mantissa & 0x1fff) == 0x1000 && (half & 1))) { half++; }
+    return static_cast<uint16_t>(half);
+}
+
+static float from_half(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+
+    uint32_t f;
+    if(exponent == 0) {
+        if(mantissa == 0) { f = sign; }
+        else {
+            // Subnormal: value is mantissa * 2^-24
+            const float value = std::ldexp(static_cast<float>(mantissa), -24);
+            std::memcpy(&f, &value, sizeof(f));
+            f |= sign;
+        }
+    }
+    else if(exponent == 31) { f = sign | 0x7f800000 | (mantissa << 13); }
+    else { f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13); }
+
+    float value;
+    std::memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+static uint16_t quantize(float x, float lo, float hi) {
+    const float t = (x - lo) / (hi - lo);
+    return static_cast<uint16_t>(std::lround(std::clamp(t, 0.0f, 1.0f) * 65535.0f));
+}
+
+static float dequantize(uint16_t code, float lo, float hi) {
+    return lo + (hi - lo) * (code / 65535.0f);
+}
+
+static uint8_t to_unorm8(float x) { return static_cast<uint8_t>(std::lround(std::clamp(x, 0.0f, 1.0f) * 255.0f)); }
+static uint8_t to_snorm8(float x) { return static_cast<uint8_t>(static_cast<int8_t>(std::lround(std::clamp(x, -1.0f, 1.0f) * 127.0f))); }
+static float from_snorm8(uint8_t x) { return static_cast<int8_t>(x) / 127.0f; }
+
+// 16 bit values go in as two planes, every low byte and then every high byte
+static void put_plane(std::vector<uint8_t>& raw, const std::vector<uint16_t>& values) {
+    for(uint16_t v: values) { raw.push_back(static_cast<uint8_t>(v & 0xff)); }
+    for(uint16_t v: values) { raw.push_back(static_cast<uint8_t>(v >> 8)); }
+}
+
+// Reads n values written by put_plane at cursor, throws when the stream is too short
+static void get_plane(const std::vector<uint8_t>& raw, size_t& cursor, std::vector<uint16_t>& values, size_t n) {
+    if(raw.size() - cursor < 2 * n) { throw std::runtime_error("Frame stream is too short"); }
+    values.resize(n);
+    const uint8_t* lo = raw.data() + cursor;
+    const uint8_t* hi = lo + n;
+    for(size_t i = 0; i < n; i++) { values[i] = static_cast<uint16_t>(lo[i] | (hi[i] << 8)); }
+    cursor += 2 * n;
+}
+
+static const uint8_t* get_bytes(const std::vector<uint8_t>& raw, size_t& cursor, size_t n) {
+    if(raw.size() - cursor < n) { throw std::runtime_error("Frame stream is too short"); }
+    const uint8_t* bytes = raw.data() + cursor;
+    cursor += n;
+    return bytes;
+}
+
+void FrameEncoder::encode(int frame, const FrameHeader& header, const std::vector<Particle_buffer>& particles,
+                          const std::vector<Vertex>& triangles, std::vector<uint8_t>& out) {
+    const uint32_t channels = main_c::frame_channels & frame_all_channels;
+    const size_t n = particles.size();
+    const size_t vertices = (channels & frame_triangles) ? header.triangle_count : 0;
+
+    // Adaptive resolution changes which particle a record stands for, so deltas would be meaningless
+    bool key = keyframe < 0 || main_c::keyframe_interval <= 1 || frame - keyframe >= main_c::keyframe_interval ||
+               key_codes.size() != 3 * n || sph_c::adaptive_levels > 0 || !(channels & frame_position);
+    for(size_t i = 0; i < n && !key; i++) {
+        const glm::vec3& x = particles[i].position;
+        key = glm::min(x, range_min) != range_min || glm::max(x, range_max) != range_max;
+    }
+
+    // A keyframe's range covers the tank and every particle with a margin, so the delta frames
+    // after it rarely have a particle outside
+    if(key) {
+        const glm::vec3 box(header.box_limits);
+        glm::vec3 lo = -box;
+        glm::vec3 hi = box;
+        for(const Particle_buffer& p: particles) {
+            lo = glm::min(lo, p.position);
+            hi = glm::max(hi, p.position);
+        }
+        const glm::vec3 margin = 0.25f * (hi - lo);
+        range_min = lo - margin;
+        range_max = hi + margin;
+    }
+
+    raw.clear();
+    if(channels & frame_position) {
+        codes.resize(3 * n);
+        for(int a = 0; a < 3; a++) {
+            for(size_t i = 0; i < n; i++) {
+                codes[a * n + i] = quantize(particles[i].position[a], range_min[a], range_max[a]);
+            }
+        }
+
+        plane.resize(n);
+        for(size_t a = 0; a < 3; a++) {
+            const uint16_t* c = codes.data() + a * n;
+            const uint16_t* k = key_codes.data() + a * n;
+            for(size_t i = 0; i < n; i++) {
+                plane[i] = key ? static_cast<uint16_t>(c[i] - (i > 0 ? c[i - 1] : 0)) : static_cast<uint16_t>(c[i] - k[i]);
+            }
+            put_plane(raw, plane);
+        }
+
+        if(key) {
+            keyframe = frame;
+            key_codes = codes;
+        }
+    }
+
+    if(channels & frame_color) {
+        for(int a = 0; a < 4; a++) {
+            for(const Particle_buffer& p: particles) { raw.push_back(to_unorm8(p.color[a])); }
+        }
+    }
+
+    const auto put_half = [&](auto&& value) {
+        plane.resize(n);
+        for(size_t i = 0; i < n; i++) { plane[i] = to_half(value(particles[i])); }
+        put_plane(raw, plane);
+    };
+    if(channels & frame_density) { put_half([](const Particle_buffer& p) { return p.density; }); }
+    if(channels & frame_velocity) {
+        for(int a = 0; a < 3; a++) { put_half([a](const Particle_buffer& p) { return p.velocity[a]; }); }
+    }
+    if(channels & frame_pressure) { put_half([](const Particle_buffer& p) { return p.pressure; }); }
+
+    if(vertices > 0) {
+        plane.resize(vertices);
+        for(int a = 0; a < 3; a++) {
+            uint16_t last = 0;
+            for(size_t v = 0; v < vertices; v++) {
+                const uint16_t c = quantize(triangles[v].position[a], range_min[a], range_max[a]);
+                plane[v] = static_cast<uint16_t>(c - last);
+                last = c;
+            }
+            put_plane(raw, plane);
+        }
+        for(int a = 0; a < 3; a++) {
+            for(size_t v = 0; v < vertices; v++) { raw.push_back(to_snorm8(triangles[v].normal[a])); }
+        }
+    }
+
+    FrameEncoding encoding;
+    encoding.frame = static_cast<uint32_t>(frame);
+    encoding.keyframe = static_cast<uint32_t>(key ? frame : keyframe);
+    encoding.channels = channels;
+    encoding.range_min = range_min;
+    encoding.range_max = range_max;
+    encoding.raw_bytes = static_cast<uint32_t>(raw.size());
+
+    const size_t at = out.size();
+    out.resize(at + sizeof(FrameEncoding));
+    encoding.packed_bytes = static_cast<uint32_t>(lz::compress(raw.data(), raw.size(), out));
+    std::memcpy(out.data() + at, &encoding, sizeof(FrameEncoding));
+}
+
+void FrameDecoder::decode(const FrameHeader& header, const FrameEncoding& encoding, const uint8_t* packed,
+                          ParticleStore& particles, std::vector<Vertex>* triangles) {
+    const uint32_t channels = encoding.channels;
+    const size_t n = header.particle_count;
+    const size_t vertices = (channels & frame_triangles) ? header.triangle_count : 0;
+    const bool key = encoding.keyframe == encoding.frame;
+
+    if((channels & frame_position) && !key && (!has_keyframe(encoding.keyframe) || key_codes.size() != 3 * n)) {
+        throw std::runtime_error("Delta frame " + std::to_string(encoding.frame) + " without its keyframe " +
+                                 std::to_string(encoding.keyframe));
+    }
+
+    raw.resize(encoding.raw_bytes);
+    lz::decompress(packed, encoding.packed_bytes, raw.data(), raw.size());
+    size_t cursor = 0;
+
+    particles.resize(n);
+    std::fill(particles.colors.begin(), particles.colors.end(), glm::vec4(1.0f));
+
+    if(channels & frame_position) {
+        codes.resize(3 * n);
+        for(size_t a = 0; a < 3; a++) {
+            get_plane(raw, cursor, plane, n);
+            uint16_t* c = codes.data() + a * n;
+            const uint16_t* k = key_codes.data() + a * n;
+            for(size_t i = 0; i < n; i++) {
+                c[i] = key ? static_cast<uint16_t>(plane[i] + (i > 0 ? c[i - 1] : 0)) : static_cast<uint16_t>(plane[i] + k[i]);
+            }
+            for(size_t i = 0; i < n; i++) {
+                particles.positions[i][a] = dequantize(c[i], encoding.range_min[a], encoding.range_max[a]);
+            }
+        }
+
+        if(key) {
+            keyframe = static_cast<int>(encoding.frame);
+            key_codes = codes;
+        }
+    }
+
+    if(channels & frame_color) {
+        for(int a = 0; a < 4; a++) {
+            const uint8_t* bytes = get_bytes(raw, cursor, n);
+            for(size_t i = 0; i < n; i++) { particles.colors[i][a] = bytes[i] / 255.0f; }
+        }
+    }
+
+    const auto get_half = [&](auto&& store) {
+        get_plane(raw, cursor, plane, n);
+        for(size_t i = 0; i < n; i++) { store(i, from_half(plane[i])); }
+    };
+    if(channels & frame_density) { get_half([&](size_t i, float v) { particles.densities[i] = v; }); }
+    if(channels & frame_velocity) {
+        for(int a = 0; a < 3; a++) { get_half([&](size_t i, float v) { particles.velocities[i][a] = v; }); }
+    }
+    if(channels & frame_pressure) { get_half([&](size_t i, float v) { particles.pressures[i] = v; }); }
+
+    if(!triangles) { return; }
+    triangles->resize(vertices);
+    if(vertices == 0) { return; }
+
+    for(int a = 0; a < 3; a++) {
+        get_plane(raw, cursor, plane, vertices);
+        uint16_t c = 0;
+        for(size_t v = 0; v < vertices; v++) {
+            c = static_cast<uint16_t>(c + plane[v]);
+            (*triangles)[v].position[a] = dequantize(c, encoding.range_min[a], encoding.range_max[a]);
+        }
+    }
+    for(int a = 0; a < 3; a++) {
+        const uint8_t* bytes = get_bytes(raw, cursor, vertices);
+        for(size_t v = 0; v < vertices; v++) { (*triangles)[v].normal[a] = from_snorm8(bytes[v]); }
+    }
+}
@@ -0,0 +1,345 @@
+#include "frame.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <utility>
+#include <stdexcept>
+
+#include "frame_archive.h"
+#include "sph_consts.h"
+
+static void append_bytes(std::vector<uint8_t>& bytes, const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    bytes.insert(bytes.end(), p, p + size);
+}
+
+static constexpr size_t channel_alignment = 16;
+
+// The version 6 channels in the order they are written, with their f32 component counts
+static const std::pair<uint32_t, uint8_t> frame_layout[] = {
+    {frame_position, 3}, {frame_color, 4}, {frame_density, 1}, {frame_velocity, 3}, {frame_pressure, 1}, {frame_triangles, 6}
+};
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float) && sizeof(glm::vec4) == 4 * sizeof(float), "Channels are copied as arrays");
+static_assert(sizeof(Vertex) == 6 * sizeof(float), "Triangles are copied as arrays");
+
+// Copies a version 6 channel into dst when it has the expected layout
+static bool read_channel(const uint8_t* frame, size_t size, uint32_t channel, uint8_t count, size_t elements, void* dst) {
+    FrameChannelDesc desc;
+    const uint8_t* src = frame_channel(frame, size, channel, &desc);
+    if (!src || desc.type != ChannelType::f32 || desc.width != sizeof(float) || desc.count != count || desc.elements != elements) return false;
+    std::memcpy(dst, src, elements * count * sizeof(float));
+    return true;
+}
+
+// Name of another frame of the sequence filename belongs to, e.g. a delta frame's keyframe
+static std::string sibling_frame(const std::string& filename, uint32_t frame_number) {
+    size_t digits = filename.size() >= 4 ? filename.size() - 4 : 0;
+    while (digits > 0 && std::isdigit(static_cast<unsigned char>(filename[digits - 1]))) { digits--; }
+    return frame_filename(filename.substr(0, digits), static_cast<int>(frame_number));
+}
+
+// std::tuple<FrameHeader, std::vector<Particle_buffer> , std::vector<glm::vec3>>
+// load_frame_data(const std::string& filename) {
+    FrameData FrameReader::load(const std::string& filename, bool load_cube_marching){
+    FrameData frame;
+    load(filename, frame, load_cube_marching);
+    return frame;
+}
+
+void FrameReader::load(const std::string& filename, FrameData& frame, bool load_cube_marching) {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) throw std::runtime_error("Can't open " + filename);
+
+    bytes.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    if (frame_bytes(bytes.data(), bytes.size()) == 0)
+        throw std::runtime_error("Invalid or truncated frame " + filename);
+
+    // Decoding the keyframe leaves its positions in the decoder, the file is put aside meanwhile
+    const FrameHeader& header = *reinterpret_cast<const FrameHeader*>(bytes.data());
+    if (header.version == 5) {
+        FrameEncoding encoding;
+        std::memcpy(&encoding, bytes.data() + sizeof(FrameHeader), sizeof(FrameEncoding));
+        if (encoding.keyframe != encoding.frame && !decoder.has_keyframe(encoding.keyframe)) {
+            std::vector<uint8_t> current;
+            std::swap(current, bytes);
+            load(sibling_frame(filename, encoding.keyframe), frame, false);
+            std::swap(current, bytes);
+        }
+    }
+
+    decode(bytes.data(), bytes.size(), frame, load_cube_marching);
+}
+
+FrameData FrameReader::decode(const uint8_t* frame, size_t size, bool load_cube_marching) {
+    FrameData data;
+    decode(frame, size, data, load_cube_marching);
+    return data;
+}
+
+void FrameReader::decode(const uint8_t* frame, size_t size, FrameData& data, bool load_cube_marching) {
+    if (frame_bytes(frame, size) == 0)
+        throw std::runtime_error("Invalid or truncated frame");
+
+    auto& [header, particles, triangles] = data;
+    triangles.clear();
+
+    // Read header
+    std::memcpy(&header, frame, sizeof(FrameHeader));
+    const uint8_t* payload = frame + sizeof(FrameHeader);
+
+    if (header.version == 5) {
+        FrameEncoding encoding;
+        std::memcpy(&encoding, payload, sizeof(FrameEncoding));
+        decoder.decode(header, encoding, payload + sizeof(FrameEncoding), particles, load_cube_marching ? &triangles : nullptr);
+        return;
+    }
+
+    if (header.version == 6) {
+        const size_t n = header.particle_count;
+        particles.resize(n);
+        if (!read_channel(frame, size, frame_position, 3, n, particles.positions.data()))
+            std::fill(particles.positions.begin(), particles.positions.end(), glm::vec3(0.0f));
+        if (!read_channel(frame, size, frame_color, 4, n, particles.colors.data()))
+            std::fill(particles.colors.begin(), particles.colors.end(), glm::vec4(1.0f));
+        if (!read_channel(frame, size, frame_density, 1, n, particles.densities.data()))
+            std::fill(particles.densities.begin(), particles.densities.end(), 0.0f);
+        if (!read_channel(frame, size, frame_velocity, 3, n, particles.velocities.data()))
+            std::fill(particles.velocities.begin(), particles.velocities.end(), glm::vec3(0.0f));
+        if (!read_channel(frame, size, frame_pressure, 1, n, particles.pressures.data()))
+            std::fill(particles.pressures.begin(), particles.pressures.end(), 0.0f);
+
+        if (load_cube_marching && header.triangle_count > 0) {
+            triangles.resize(header.triangle_count);
+            if (!read_channel(frame, size, frame_triangles, 6, triangles.size(), triangles.data())) triangles.clear();
+        }
+        return;
+    }
+
+    // Read particles
+    const Particle_buffer* buffer = reinterpret_cast<const Particle_buffer*>(payload);
+    particles.resize(header.particle_count);
+    for (uint32_t i = 0; i < header.particle_count; i++) {
+        particles.positions[i] = buffer[i].position;
+        particles.colors[i] = buffer[i].color;
+        particles.densities[i] = buffer[i].density;
+        particles.velocities[i] = buffer[i].velocity;
+        particles.pressures[i] = buffer[i].pressure;
+    }
+
+    // std::vector<glm::vec3> triangles(header.triangle_count);
+    // in.read(reinterpret_cast<char*>(triangles.data()), header.triangle_count * sizeof(glm::vec3));
+    if (load_cube_marching && header.triangle_count > 0) {
+        const Vertex* vertices = reinterpret_cast<const Vertex*>(buffer + header.particle_count);
+        triangles.assign(vertices, vertices + header.triangle_count);
+    }
+}
+
+FrameData load_frame_data(const std::string& filename, bool load_cube_marching) {
+    thread_local FrameReader reader;
+    return reader.load(filename, load_cube_marching);
+}
+
+std::string frame_filename(const std::string& prefix, int frame_number) {
+    std::ostringstream filename;
+    filename << prefix << std::setw(4) << std::setfill('0') << frame_number << ".bin";
+    return filename.str();
+}
+
+std::string frame_archive_filename(const std::string& prefix) {
+    return prefix + "archive.sph";
+}
+
+size_t frame_bytes(const uint8_t* frame, size_t available) {
+    if (available < sizeof(FrameHeader)) return 0;
+
+    FrameHeader header;
+    std::memcpy(&header, frame, sizeof(FrameHeader));
+    if (std::string(header.magic, 3) != "SPH") return 0;
+
+    uint64_t size = sizeof(FrameHeader);
+    if (header.version == 4) {
+        size += uint64_t(header.particle_count) * sizeof(Particle_buffer) + uint64_t(header.triangle_count) * sizeof(Vertex);
+    }
+    else if (header.version == 5) {
+        if (available < sizeof(FrameHeader) + sizeof(FrameEncoding)) return 0;
+        FrameEncoding encoding;
+        std::memcpy(&encoding, frame + sizeof(FrameHeader), sizeof(FrameEncoding));
+        size += sizeof(FrameEncoding) + encoding.packed_bytes;
+    }
+    else if (header.version == 6) {
+        uint32_t count;
+        if (available < sizeof(FrameHeader) + sizeof(count)) return 0;
+        std::memcpy(&count, frame + sizeof(FrameHeader), sizeof(count));
+        size += sizeof(count) + uint64_t(count) * sizeof(FrameChannelDesc);
+        if (size > available) return 0;
+
+        // The frame ends with its last array
+        const uint8_t* table = frame + sizeof(FrameHeader) + sizeof(count);
+        const uint64_t table_end = size;
+        for (uint32_t c = 0; c < count; c++) {
+            FrameChannelDesc desc;
+            std::memcpy(&desc, table + c * sizeof(FrameChannelDesc), sizeof(FrameChannelDesc));
+            if (desc.offset < table_end) return 0;
+            size = std::max(size, desc.offset + uint64_t(desc.elements) * desc.count * desc.width);
+        }
+    }
+    else return 0;
+
+    return size <= available ? static_cast<size_t>(size) : 0;
+}
+
+const uint8_t* frame_channel(const uint8_t* frame, size_t size, uint32_t channel, FrameChannelDesc* desc) {
+    FrameHeader header;
+    std::memcpy(&header, frame, sizeof(FrameHeader));
+    if (header.version != 6) return nullptr;
+
+    uint32_t count;
+    std::memcpy(&count, frame + sizeof(FrameHeader), sizeof(count));
+    const uint8_t* table = frame + sizeof(FrameHeader) + sizeof(count);
+    for (uint32_t c = 0; c < count; c++) {
+        FrameChannelDesc entry;
+        std::memcpy(&entry, table + c * sizeof(FrameChannelDesc), sizeof(FrameChannelDesc));
+        if (entry.channel != channel) continue;
+        if (entry.offset + uint64_t(entry.elements) * entry.count * entry.width > size) return nullptr;
+        if (desc) *desc = entry;
+        return frame + entry.offset;
+    }
+    return nullptr;
+}
+
+uint32_t frame_keyframe(const uint8_t* frame, size_t size, uint32_t frame_number) {
+    FrameHeader header;
+    std::memcpy(&header, frame, sizeof(FrameHeader));
+    if (header.version != 5 || size < sizeof(FrameHeader) + sizeof(FrameEncoding)) return frame_number;
+
+    FrameEncoding encoding;
+    std::memcpy(&encoding, frame + sizeof(FrameHeader), sizeof(FrameEncoding));
+    return encoding.keyframe == encoding.frame ? frame_number : encoding.keyframe;
+}
+
+void capture_frame(const Simulation& sph, const Camera& cam,
+                   FrameHeader& header, std::vector<Particle_buffer>& buffer) {
+    header = FrameHeader {};
+    header.timestamp = sph.time;
+    header.particle_count = static_cast<uint32_t>(sph.particles.size());
+    header.h = sph.h;
+    header.dt = sph.delta_time;
+    header.view = cam.view;
+    header.projection = cam.projection;
+    header.gravity = sph.gravity;
+    header.damping_factor = sph.damping_factor;
+    header.box_limits = glm::vec4(sph.lim_x, sph.lim_y, sph.lim_z, 5);
+    header.triangle_count = 0;
+
+    const ParticleStore& particles = sph.particles;
+    const size_t n = particles.size();
+    buffer.resize(n);
+    const auto record = [&](Particle_buffer& fp, size_t i) {
+        fp.position = particles.positions[i];
+        fp.density = particles.densities[i];
+        fp.velocity = particles.velocities[i];
+        fp.pressure = particles.pressures[i];
+        fp.color = particles.colors[i];
+    };
+
+    // Records are written in creation order, the solver may have reordered the arrays. Adaptive
+    // resolution retires ids and hands out new ones, so there they have to be sorted.
+    if (sph_c::adaptive_levels == 0) {
+        for (size_t i = 0; i < n; i++) { record(buffer[particles.ids[i]], i); }
+        return;
+    }
+
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return particles.ids[a] < particles.ids[b]; });
+    for (size_t k = 0; k < n; k++) { record(buffer[k], order[k]); }
+}
+
+FrameWriter::FrameWriter(const std::string& prefix): prefix(prefix) {
+    if (!main_c::frame_archive) return;
+    try {
+        archive.reset(new FrameArchiveWriter(frame_archive_filename(prefix)));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << ", writing a file per frame" << std::endl;
+    }
+}
+
+FrameWriter::~FrameWriter() = default;
+
+void FrameWriter::write_channels(const FrameHeader& header, const std::vector<Particle_buffer>& buffer,
+                                 const std::vector<Vertex>& triangles) {
+    std::vector<FrameChannelDesc> table;
+    for (const auto& [channel, count]: frame_layout) {
+        if (!(main_c::frame_channels & channel)) continue;
+        FrameChannelDesc desc;
+        desc.channel = channel;
+        desc.type = ChannelType::f32;
+        desc.width = sizeof(float);
+        desc.count = count;
+        desc.elements = channel == frame_triangles ? header.triangle_count : static_cast<uint32_t>(buffer.size());
+        desc.offset = 0;
+        table.push_back(desc);
+    }
+
+    uint64_t offset = sizeof(FrameHeader) + sizeof(uint32_t) + table.size() * sizeof(FrameChannelDesc);
+    for (FrameChannelDesc& desc: table) {
+        offset = (offset + channel_alignment - 1) / channel_alignment * channel_alignment;
+        desc.offset = offset;
+        offset += uint64_t(desc.elements) * desc.count * desc.width;
+    }
+
+    const uint32_t count = static_cast<uint32_t>(table.size());
+    append_bytes(bytes, &header, sizeof(FrameHeader));
+    append_bytes(bytes, &count, sizeof(count));
+    append_bytes(bytes, table.data(), table.size() * sizeof(FrameChannelDesc));
+
+    // The records are split into one array per channel
+    for (const FrameChannelDesc& desc: table) {
+        bytes.resize(desc.offset, 0);
+        switch (desc.channel) {
+            case frame_position: for (const Particle_buffer& p: buffer) { append_bytes(bytes, &p.position, sizeof(glm::vec3)); } break;
+            case frame_color:    for (const Particle_buffer& p: buffer) { append_bytes(bytes, &p.color, sizeof(glm::vec4)); } break;
+            case frame_density:  for (const Particle_buffer& p: buffer) { append_bytes(bytes, &p.density, sizeof(float)); } break;
+            case frame_velocity: for (const Particle_buffer& p: buffer) { append_bytes(bytes, &p.velocity, sizeof(glm::vec3)); } break;
+            case frame_pressure: for (const Particle_buffer& p: buffer) { append_bytes(bytes, &p.pressure, sizeof(float)); } break;
+            case frame_triangles: append_bytes(bytes, triangles.data(), header.triangle_count * sizeof(Vertex)); break;
+        }
+    }
+}
+
+void FrameWriter::write(int frame_number, FrameHeader header,
+                        const std::vector<Particle_buffer>& buffer, const std::vector<Vertex>& triangles) {
+    bytes.clear();
+    if (!main_c::frame_compression) {
+        header.version = 6;
+        if (!(main_c::frame_channels & frame_triangles)) { header.triangle_count = 0; }
+        write_channels(header, buffer, triangles);
+    }
+    else {
+        header.version = 5;
+        if (!(main_c::frame_channels & frame_triangles)) { header.triangle_count = 0; }
+        append_bytes(bytes, &header, sizeof(FrameHeader));
+        encoder.encode(frame_number, header, buffer, triangles, bytes);
+    }
+
+    if (archive) {
+        archive->append(static_cast<uint32_t>(frame_number), bytes.data(), bytes.size());
+        return;
+    }
+
+    const std::string filename = frame_filename(prefix, frame_number);
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error opening: " << filename << std::endl;
+        return;
+    }
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
@@ -0,0 +1,62 @@
+#include "frame_prefetch.h"
+
+#include <algorithm>
+#include <iostream>
+
+FramePrefetcher::FramePrefetcher(FrameArchive* archive, const std::string& prefix, size_t depth, bool load_cube_marching):
+    archive(archive), prefix(prefix), load_cube_marching(load_cube_marching),
+    frames(std::max<size_t>(depth, 1)), free_frames(frames.size()), ready(frames.size()) {
+
+    for(PrefetchedFrame& frame: frames) { free_frames.push(&frame); }
+    worker = std::thread(&FramePrefetcher::run, this);
+}
+
+FramePrefetcher::~FramePrefetcher() {
+    stopping = true;
+    free_frames.close();
+    worker.join();
+}
+
+void FramePrefetcher::run() {
+    FrameReader reader;
+
+    PrefetchedFrame* frame;
+    for(size_t i = 0; !stopping && free_frames.pop(frame); i++) {
+        frame->index = i;
+        frame->mapped_triangles = nullptr;
+        try {
+            if(archive) {
+                if(i >= archive->size()) { break; }
+                if(load_cube_marching) { frame->mapped_triangles = archive->raw_triangles(i); }
+                archive->load(i, frame->data, load_cube_marching && !frame->mapped_triangles);
+            }
+            else { reader.load(frame_filename(prefix, static_cast<int>(i)), frame->data, load_cube_marching); }
+        } catch(const std::exception& e) {
+            std::cerr << "Loading failed: " << e.what() << std::endl;
+            break;
+        }
+        ready.push(frame);
+    }
+
+    ready.close();
+}
+
+PrefetchedFrame* FramePrefetcher::next() {
+    if(current) { free_frames.push(current); }
+    if(!ready.pop(current)) { current = nullptr; }
+    return current;
+}
+
+void FramePacer::wait(double timestamp) {
+    using clock = std::chrono::steady_clock;
+    if(speed <= 0.0) { return; }
+
+    const auto at = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(timestamp / speed));
+    const clock::time_point now = clock::now();
+    if(!started || now > origin + at + std::chrono::milliseconds(100)) {
+        origin = now - at;
+        started = true;
+        return;
+    }
+    std::this_thread::sleep_until(origin + at);
+}
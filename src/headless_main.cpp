@@ -0,0 +1,50 @@
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "batch.h"
+#include "camera.h"
+#include "domain_decomposition.h"
+#include "sph_consts.h"
+#include "thread_pool.h"
+
+using namespace main_c;
+
+// Save mode of the simulator for machines without a display: no GLFW, no GL context and no
+// shaders, only the SPH steps, marching cubes and the frame files
+int main(int argc, char* argv[]) {
+    if(argc < 3) {
+        std::cerr << "Usage: ./simulator_headless Remeshing:[true|false] Phong Shading:[true|false] [Solver:wcsph|pbf] [Processes]" << std::endl;
+        return 1;
+    }
+
+    const bool marching_cubes = std::string(argv[1]) == "true";
+    const bool phong = std::string(argv[2]) == "true";
+    const std::string solver_s = (argc > 3) ? argv[3] : "";
+    const int process_count = (argc > 4) ? std::atoi(argv[4]) : processes;
+
+    // Phong shading only matters to the viewer, it picks the directory `simulator load` replays
+    const std::string save_location = std::string("march") + (marching_cubes ? "on" : "off") + "phong" + (phong ? "on" : "off");
+
+    // Workers are forked before this process starts any threads
+    std::unique_ptr<DomainDecomposition> domain = nullptr;
+    if(process_count > 1) {
+        if(solver_s == "pbf" || sph_c::adaptive_levels > 0) {
+            std::cerr << "Multiple processes need the wcsph solver and uniform resolution" << std::endl;
+            return 1;
+        }
+        domain.reset(new DomainDecomposition{process_count, Simulation::cube_particle_count(cube_side_length, cube_spacing)});
+        std::cout << "Domain split over " << domain->size() << " processes" << std::endl;
+    }
+
+    ThreadPool pool(num_threads, pin_threads, numa_aware);
+    std::cout << "Using " << pool.size() << " threads\n";
+    if(numa_aware) { std::cout << "Threads spread over " << pool.nodes() << " NUMA node(s)\n"; }
+
+    // The camera is only recorded in the frame headers for replay
+    Camera cam {cam_pos, cam_target, cam_up, cam_fov, (float) width, (float) height, cam_near, cam_far};
+    Scene scene {pool, solver_s, marching_cubes};
+    run_save_mode(scene, domain.get(), cam, "../frames_" + save_location + "/frame_");
+
+    return 0;
+}
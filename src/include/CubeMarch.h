@@ -1,14 +1,21 @@
+#pragma once
+
 #include <vector>
 #include <unordered_map>
-#include <thread>
+#include <functional>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include "particle.h"
-#include "sph.h"
+#include "neighbor_search.h"
+#include "sph_consts.h"
+#include "sph_kernels.h"
+#include "thread_pool.h"
+#include "neighbor_table.h"
+#include "arena.h"
 
 struct CubeCell {
     glm::vec3 position;
     float color;
-    std::vector<Particle*> neighbors;
 };
 
 struct Triangle{
@@ -36,17 +43,36 @@ struct EdgeHash {
     }
 };
 
-class CubeMarch {
-private:
-    int num_threads;
-    float h;
+// Shared edge -> (vertex, accumulated normal) map, allocated from a frame arena
+using EdgeMap = std::unordered_map<Edge, std::pair<glm::vec3, glm::vec3>, EdgeHash, std::equal_to<Edge>,
+                                   ArenaAllocator<std::pair<const Edge, std::pair<glm::vec3, glm::vec3>>>>;
 
-    SPH* sph;
+// Lookup tables shared by every CubeMarch instantiation, defined in CubeMarchTable.cpp
+struct CubeMarchTables {
     static int edgeTable[256];
     static int triTable[256][16];
     static int edgeMap[12][2];
+};
+
+// Search is the neighbor backend the simulation runs with, see neighbor_search.h
+template <typename Search>
+class CubeMarch : private CubeMarchTables {
+private:
+    float h;
 
-    SpatialHash& sp_hash;
+    // The color field reads the simulation's particles but always uses the poly6 kernel,
+    // iso_value is tuned for it whichever kernel the solver runs with
+    const ParticleStore& particles;
+    float mass;
+    KernelCoeffs kernel;
+    Search& sp_hash;
+    ThreadPool& pool;
+
+    // Per-chunk scratch for MarchingCubes: the edge maps live in the arenas, which are
+    // reset every call, and the edge lists keep their capacity between calls
+    std::vector<Arena> arenas;
+    std::vector<std::vector<Edge>> local_triangles;
+    std::vector<size_t> last_map_sizes;
 
 public:
     int nx;
@@ -55,11 +81,13 @@ public:
     int iso_value;
 
     float len_cube;
+    NeighborMode neighbor_mode = sph_c::neighbor_mode;
     std::vector<CubeCell> cells;
+    NeighborTable neighbors {true};
     // std::vector<glm::vec3> triangles;
     std::vector<Vertex> triangles;
 
-    CubeMarch(float lim_x, float lim_y, float lim_z, float len, float smoothing_dist, SPH* sph_ptr, float iv, SpatialHash& sh);
+    CubeMarch(float lim_x, float lim_y, float lim_z, float len, float smoothing_dist, const ParticleStore& ps, float particle_mass, float iv, Search& sh, ThreadPool& tp);
 
     void MarchingCubes();
     void march_cubes(int begin, int end, std::vector<glm::vec3>& tris);
@@ -67,31 +95,17 @@ public:
     glm::vec3 vertex_interpolation(float iso_value, int p1, int p2);
 
     void update_color(std::vector<CubeCell>::iterator begin, std::vector<CubeCell>::iterator end);
-    void update_neighbors(std::vector<CubeCell>::iterator begin, std::vector<CubeCell>::iterator end);
+    void update_neighbors();
     void load_triangles(const std::vector<Vertex>& loaded_triangles);
 
-    void march_cubes(int begin, int end, std::unordered_map<Edge, std::pair<glm::vec3, glm::vec3>, EdgeHash>& goon, std::vector<Edge>& tris);
+    void march_cubes(int begin, int end, EdgeMap& goon, std::vector<Edge>& tris);
 
     template <typename Func, typename... Args>
     void parallel(Func&& func, Args&&... args) {
-        int total = cells.size();
-        int chunk = (total + num_threads - 1) / num_threads;
-
-        std::vector<std::thread> threads;
-
-        for(int i = 0; i < num_threads; i++) {
-            auto begin = cells.begin() + i * chunk;
-            auto end = cells.begin() + std::min((i + 1) * chunk, total);
-
-            if(begin - cells.begin() >= total) { break; }
-
-            threads.emplace_back(
-                [this, begin, end, &func, &args...]() {
-                    std::invoke(func, this, begin, end, std::forward<Args>(args)...);
-                }
-            );
-        }
-
-        for(auto& t: threads) { t.join(); }
+        pool.parallel_for(cells.size(), [this, &func, &args...](size_t begin, size_t end) {
+            std::invoke(func, this, cells.begin() + begin, cells.begin() + end, args...);
+        });
     }
 };
+
+using SurfaceMesh = CubeMarch<SelectedSearch>;
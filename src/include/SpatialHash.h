@@ -1,31 +1,59 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <glm/glm.hpp>
 
 #include "particle.h"
+#include "cell_buckets.h"
+#include "thread_pool.h"
 
+// Unbounded neighbor search: cells are hashed into a fixed table, so distant
+// cells can share a bucket and candidates must be pruned by distance
 class SpatialHash {
 private:
     float m_cellSize;       // Typically 2x smoothing length (h)
     uint32_t m_tableSize;   // Prime number for better distribution
-    uint32_t* m_particleTable;
-    std::vector<Particle*> m_sortedParticles;
-    std::vector<Particle> m_sortedParticlesC;
+    CellBuckets m_buckets;
 
     const float h;
     
 public:
+    static constexpr const char* name = "hash";
+
     uint32_t computeHash(const glm::ivec3& cell) const;
+    uint32_t bucketCount() const { return m_tableSize; }
 
     SpatialHash(float smoothing_dist, uint32_t tableSize = 262144);
-    ~SpatialHash();
 
     // Prevent copying
     SpatialHash(const SpatialHash&) = delete;
     SpatialHash& operator=(const SpatialHash&) = delete;
 
-    void build(std::vector<Particle>& particles);
-    void queryNeighbors(glm::vec3 pos, std::vector<Particle*>& neighbors);
+    // Buckets the particles by hash_values
+    void build(const ParticleStore& particles, ThreadPool& pool);
+    void queryNeighbors(glm::vec3 pos, std::vector<uint32_t>& neighbors) const;
     glm::ivec3 positionToCell(const glm::vec3& pos) const;
+
+    // Calls visit(index) once for every particle in the 27 cells around pos (125 with reach 2),
+    // without storing a list. Cells that hash to a bucket already visited are skipped so colliding
+    // cells are not counted twice.
+    template <typename Visit>
+    void forEachNeighbor(glm::vec3 pos, Visit&& visit, int reach = 1) const {
+        const glm::ivec3 baseCell = positionToCell(pos);
+        uint32_t seen[125];
+        int seenCount = 0;
+
+        for(int dx = -reach; dx <= reach; ++dx) {
+            for(int dy = -reach; dy <= reach; ++dy) {
+                for(int dz = -reach; dz <= reach; ++dz) {
+                    const uint32_t hash = computeHash(baseCell + glm::ivec3(dx, dy, dz));
+                    if(std::find(seen, seen + seenCount, hash) != seen + seenCount) { continue; }
+
+                    seen[seenCount++] = hash;
+                    m_buckets.forEach(hash, hash, visit);
+                }
+            }
+        }
+    }
 };
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts every call to the global operator new (replaced in alloc_counter.cpp), so
+// a caller can check that a steady-state step performs no heap allocations
+namespace alloc_counter {
+    uint64_t count();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Bump allocator for per-frame scratch. allocate() hands out memory from the current
+// block and reset() rewinds it, individual frees are no-ops. When a frame overflows,
+// extra blocks are chained and the next reset() merges them into one block big enough
+// for the whole frame, so after warm-up a frame never touches the heap. Not thread
+// safe: give each pool chunk its own arena.
+class Arena {
+private:
+    struct Block {
+        char* data;
+        size_t size;
+        bool mapped;
+    };
+
+    std::vector<Block> blocks;
+    size_t offset = 0;      // Into blocks.back()
+    bool huge_pages;
+
+    void add_block(size_t size);
+    static void release(Block& block);
+
+public:
+    explicit Arena(size_t initial_size = 1 << 20, bool use_huge_pages = false);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment);
+    void reset();
+
+    size_t capacity() const;
+};
+
+// STL allocator over an Arena, containers using it must not outlive the arena's next reset()
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena& a): arena(&a) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other): arena(other.arena) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, std::size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "camera.h"
+#include "CubeMarch.h"
+#include "domain_decomposition.h"
+#include "sph.h"
+#include "thread_pool.h"
+
+// What every run mode simulates: the particle cube in the container, and the surface mesh when
+// remeshing is on. Nothing here touches GL, so simulator_headless links without it.
+struct Scene {
+    SelectedSearch search;
+    Simulation sph;
+    std::unique_ptr<SurfaceMesh> cm;
+
+    // solver is "wcsph", "pbf" or empty for sph_c::solver
+    Scene(ThreadPool& pool, const std::string& solver, bool marching_cubes);
+};
+
+// Steady-state steps must not allocate, report any that do once warm-up is over
+void check_allocations(const char* phase, int frame, uint64_t count_before);
+
+// Advances the simulation one frame (over the worker processes when domain is set) and
+// refreshes the surface mesh's color field. sim_frame numbers the frame for the reports, the
+// allocation check is skipped when other threads may allocate meanwhile.
+void step_frame(Scene& scene, DomainDecomposition* domain, int sim_frame, bool alloc_checks = true);
+
+// Save mode: simulates frames 0 to main_c::max_frames, remeshes each one when the scene has a
+// surface mesh and writes it to prefix####.bin, or to the prefixarchive.sph archive with
+// main_c::frame_archive. With main_c::save_pipeline the three run on their own threads, see
+// batch.cpp.
+void run_save_mode(Scene& scene, DomainDecomposition* domain, const Camera& cam, const std::string& prefix);
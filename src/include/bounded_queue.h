@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Fixed-capacity FIFO between pipeline threads. push blocks while the queue is full and pop
+// while it is empty. Once close() is called, pop drains what is left and then returns false.
+// The ring buffer is allocated once, so passing items never touches the heap.
+template <typename T>
+class BoundedQueue {
+private:
+    std::vector<T> items;
+    size_t head = 0;
+    size_t count = 0;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+
+public:
+    explicit BoundedQueue(size_t capacity): items(capacity) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return count < items.size(); });
+        items[(head + count) % items.size()] = std::move(item);
+        count++;
+        not_empty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return count > 0 || closed; });
+        if(count == 0) { return false; }
+
+        item = std::move(items[head]);
+        head = (head + 1) % items.size();
+        count--;
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+};
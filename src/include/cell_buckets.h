@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#include "thread_pool.h"
+
+// Particle indices grouped by bucket (a hash slot or a grid cell): bucket b holds
+// sorted[start[b] .. end[b]) in index order. Shared by SpatialHash and NeighborGrid,
+// the bucket arrays are allocated once and refilled by build().
+class CellBuckets {
+private:
+    uint32_t m_bucketCount;
+    std::vector<uint32_t> m_start;
+    std::vector<uint32_t> m_end;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_cursor;  // Bucket counts, then scatter cursors
+    std::vector<uint32_t> m_chunkSums;
+    std::vector<uint32_t> m_sorted;
+
+public:
+    explicit CellBuckets(uint32_t bucketCount);
+
+    // Counting sort of keys[0 .. count), in O(count + bucket count) on the pool
+    void build(const uint32_t* keys, size_t count, ThreadPool& pool);
+
+    uint32_t bucketCount() const { return m_bucketCount; }
+    uint32_t start(uint32_t bucket) const { return m_start[bucket]; }
+    uint32_t end(uint32_t bucket) const { return m_end[bucket]; }
+    uint32_t particle(uint32_t slot) const { return m_sorted[slot]; }
+
+    // Calls visit(index) for every particle in buckets first .. last
+    template <typename Visit>
+    void forEach(uint32_t first, uint32_t last, Visit&& visit) const {
+        for(uint32_t i = m_start[first]; i < m_end[last]; ++i) { visit(m_sorted[i]); }
+    }
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "sph.h"
+
+// One particle as it crosses a process boundary: halo copies, migrants and gathered frames
+struct DomainParticle {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    glm::vec4 color;
+    float density;
+    float pressure;
+    uint32_t id;
+};
+
+// Barrier for threads of different processes that share the memory it lives in.
+// wait() throws once any process has set failed.
+struct SharedBarrier {
+    std::atomic<uint32_t> arrived {0};
+    std::atomic<uint32_t> generation {0};
+
+    void wait(uint32_t parties, const std::atomic<uint32_t>& failed);
+};
+
+// Splits the tank along x into one slab per worker process on this host (Linux only). Every
+// substep a worker sends the particles within 2h of each slab face to its neighbors as halo copies,
+// so its own particles see complete neighborhoods for both density and forces, and hands over the
+// particles that left its slab. Workers agree on the smallest time step limit and only run the
+// WCSPH solver with symplectic Euler, which needs one force evaluation per substep.
+// The coordinator (the process that built this) gathers every frame for the frame writer.
+//
+// All buffers live in one anonymous shared mapping created before the workers are forked, so
+// construct this before any threads or GL state exist; the workers build their own thread pool.
+class DomainDecomposition {
+private:
+    // Particles a worker sends to one neighbor: migrants first, then halo copies.
+    // Written before and read after a step barrier, which orders the accesses.
+    struct Mailbox {
+        uint32_t migrants;
+        uint32_t halo;
+        DomainParticle* data;
+    };
+
+    // Laid out at the start of the shared mapping
+    struct Control {
+        SharedBarrier step_barrier;     // Workers, every substep
+        SharedBarrier frame_barrier;    // Workers and coordinator, twice per frame
+        std::atomic<uint32_t> failed {0};
+        std::atomic<uint32_t> stop {0};
+        double time = 0.0;              // Simulation time rank 0 reached, for the frame headers
+    };
+
+    int ranks;
+    size_t capacity;
+    void* shared = nullptr;
+    size_t shared_size = 0;
+
+    Control* control = nullptr;
+    float* limits = nullptr;            // Time step limit of every worker
+    Mailbox* mailboxes = nullptr;       // [2 * rank] to the left neighbor, [2 * rank + 1] to the right
+    uint32_t* gather_counts = nullptr;
+    DomainParticle* gather = nullptr;   // capacity records per worker
+
+    std::vector<int> workers;   // Process ids
+
+    struct Worker;
+
+    Mailbox& outbox(int rank, int side) { return mailboxes[2 * rank + side]; }
+    DomainParticle* gathered(int rank) { return gather + rank * capacity; }
+
+    int run_worker(int rank);
+
+public:
+    // particle_count is the size of the whole scene, it bounds every shared buffer
+    DomainDecomposition(int processes, size_t particle_count);
+    ~DomainDecomposition();
+
+    DomainDecomposition(const DomainDecomposition&) = delete;
+    DomainDecomposition& operator=(const DomainDecomposition&) = delete;
+
+    int size() const { return ranks; }
+
+    // Runs one frame on the workers and gathers every particle into sph, in creation order,
+    // with its search structure rebuilt for CubeMarch
+    void advance_frame(Simulation& sph);
+};
@@ -1,16 +1,29 @@
 #ifndef FRAME_H
 #define FRAME_H
-#include <glad/gl.h>
-#include <GLFW/glfw3.h>
 #include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
 #include <vector>
 #include <iostream>
 #include <glm/glm.hpp>
 #include "glm/gtc/matrix_transform.hpp"
+
+#include "camera.h"
+#include "particle.h"
+#include "sph.h"
+#include "CubeMarch.h"
+#include "frame_codec.h"
+
+// Version 4 files are the header, particle_count Particle_buffer records and triangle_count
+// Vertex records. Version 5 files are compressed, see frame_codec.h. Version 6 files are raw
+// too, but laid out by a channel table, see FrameChannelDesc. Version 6 is what gets written
+// without main_c::frame_compression, all three are read.
 #pragma pack(push, 1) // No padding
 struct FrameHeader {
     char magic[4] = {'S','P','H'}; // Identifier
-    uint32_t version = 3;          // Format version
+    uint32_t version = 4;          // Format version
     double timestamp;              // Simulation time
     uint32_t particle_count;       // For validation
     uint32_t triangle_count;       // For validation
@@ -24,5 +37,102 @@ struct FrameHeader {
     float cube_len;
     float iso_value;
 };
+
+// A version 6 frame is the header, a uint32_t channel count, that many FrameChannelDesc and the
+// channel arrays. Each array holds elements values of count components of type, little endian
+// and tightly packed (so the arrays match the ParticleStore ones and Vertex), starting at offset
+// from the frame's FrameHeader on a 16 byte boundary. Only the main_c::frame_channels channels
+// are written. Readers skip channels they don't know or whose type and count they don't expect,
+// channels that are missing load as zeros (colors as opaque white).
+enum class ChannelType : uint8_t {
+    f32 = 0
+};
+
+struct FrameChannelDesc {
+    uint32_t channel;       // A FrameChannel bit
+    ChannelType type;
+    uint8_t width;          // Bytes per component, so unknown types can be skipped
+    uint8_t count;          // Components per element
+    uint8_t reserved = 0;
+    uint32_t elements;      // particle_count, or triangle_count for frame_triangles
+    uint64_t offset;
+};
 #pragma pack(pop)
+
+// A decoded frame: its header, the particles and the triangles (empty unless asked for)
+using FrameData = std::tuple<FrameHeader, ParticleStore, std::vector<Vertex>>;
+
+// Reads frame files of either version, from disk or from memory (an archive's mapping). A delta
+// frame's keyframe is read from the file of that frame next to it, unless it is the last
+// keyframe this reader decoded.
+class FrameReader {
+private:
+    FrameDecoder decoder;
+    std::vector<uint8_t> bytes;
+
+public:
+    // The triangles are only read when asked for. The overloads taking a FrameData decode into
+    // it, reusing the capacity of its arrays.
+    FrameData load(const std::string& filename, bool load_cube_marching = true);
+    void load(const std::string& filename, FrameData& frame, bool load_cube_marching = true);
+
+    // Decodes the size bytes of a frame as they are stored in a file. A delta frame needs
+    // has_keyframe(frame_keyframe(frame, size)), decode that one first.
+    FrameData decode(const uint8_t* frame, size_t size, bool load_cube_marching = true);
+    void decode(const uint8_t* frame, size_t size, FrameData& data, bool load_cube_marching = true);
+
+    bool has_keyframe(uint32_t frame) const { return decoder.has_keyframe(frame); }
+};
+
+class FrameArchiveWriter;
+
+// Writes frames, compressed (version 5) with main_c::frame_compression and as raw channel
+// arrays (version 6) otherwise, to prefix####.bin or with main_c::frame_archive appended to
+// frame_archive_filename(prefix). Delta frames refer back to keyframes, so a run's frames have
+// to go through one writer in order.
+class FrameWriter {
+private:
+    std::string prefix;
+    FrameEncoder encoder;
+    std::vector<uint8_t> bytes;
+    std::unique_ptr<FrameArchiveWriter> archive;
+
+    // Appends a version 6 frame to bytes
+    void write_channels(const FrameHeader& header, const std::vector<Particle_buffer>& buffer,
+                        const std::vector<Vertex>& triangles);
+
+public:
+    explicit FrameWriter(const std::string& prefix);
+    ~FrameWriter();    // Writes the archive's index
+
+    // header.triangle_count triangles are written
+    void write(int frame_number, FrameHeader header,
+               const std::vector<Particle_buffer>& buffer, const std::vector<Vertex>& triangles);
+};
+
+// FrameReader::load on a reader kept per thread, so sequential loads reuse its keyframe
+FrameData load_frame_data(const std::string& filename, bool load_cube_marching = true);
+
+// prefix####.bin
+std::string frame_filename(const std::string& prefix, int frame_number);
+
+// prefixarchive.sph, the archive save mode writes instead of the prefix####.bin files
+std::string frame_archive_filename(const std::string& prefix);
+
+// Size of the frame stored at frame, 0 when it is not a frame or runs past available
+size_t frame_bytes(const uint8_t* frame, size_t available);
+
+// The array of a channel of a version 6 frame of frame_bytes() size, desc set to its table
+// entry, nullptr when the frame has no such channel
+const uint8_t* frame_channel(const uint8_t* frame, size_t size, uint32_t channel, FrameChannelDesc* desc = nullptr);
+
+// Frame the positions of a frame of frame_bytes() size are delta coded against, frame_number
+// itself for keyframes and raw frames
+uint32_t frame_keyframe(const uint8_t* frame, size_t size, uint32_t frame_number);
+
+// Snapshot of a frame for writing: the header (without triangles, stamped with sph.time) and
+// the particles as records in creation order. Nothing refers back to sph, so it may step on
+// while the frame is written.
+void capture_frame(const Simulation& sph, const Camera& cam,
+                   FrameHeader& header, std::vector<Particle_buffer>& buffer);
 #endif
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "frame.h"
+
+// A run's frames in one file: an FrameArchiveHeader, the frames back to back exactly as they
+// would be stored in their own files (each starting on an 8 byte boundary), then the index of
+// the frames and a FrameArchiveTrailer pointing at it. Frames are only ever appended, the index
+// is written when the writer finishes. An archive without one (the run was killed) is recovered
+// by walking its frames.
+#pragma pack(push, 1)
+struct FrameArchiveHeader {
+    char magic[4] = {'S','P','H','A'};
+    uint32_t version = 1;
+};
+
+struct FrameIndexEntry {
+    uint32_t frame;         // Frame number
+    uint32_t keyframe;      // Frame its positions are delta coded against, frame for keyframes
+    uint64_t offset;        // Of the frame's FrameHeader from the start of the archive
+    uint64_t size;
+    double timestamp;       // Simulation time, FrameHeader::timestamp
+};
+
+struct FrameArchiveTrailer {
+    uint64_t index_offset;
+    uint64_t frame_count;
+    char magic[4] = {'S','P','H','I'};
+    uint32_t version = 1;
+};
+#pragma pack(pop)
+
+class FrameArchiveWriter {
+private:
+    std::ofstream out;
+    uint64_t offset = 0;
+    std::vector<FrameIndexEntry> index;
+
+public:
+    // Throws std::runtime_error when filename can't be created
+    explicit FrameArchiveWriter(const std::string& filename);
+    ~FrameArchiveWriter() { finish(); }
+
+    FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+    FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+
+    // Frames must come in order, size bytes of a frame as frame_bytes() measures it
+    void append(uint32_t frame_number, const uint8_t* frame, size_t size);
+
+    // Writes the index and the trailer, the archive takes no more frames after it
+    void finish();
+};
+
+// Read-only view of an archive. The file is memory mapped (read into memory off Linux), the
+// index and the frames are read in place, so opening costs the index and nothing more, and any
+// frame can be decoded without touching the others but its keyframe.
+class FrameArchive {
+private:
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<uint8_t> contents;          // The file when it isn't mapped
+
+    const FrameIndexEntry* index = nullptr;
+    size_t count = 0;
+    std::vector<FrameIndexEntry> recovered; // The index of an archive without one
+
+    FrameReader reader;
+
+    void release();
+    void recover_index();
+
+public:
+    // Throws std::runtime_error when filename can't be opened or is not an archive
+    explicit FrameArchive(const std::string& filename);
+    ~FrameArchive();
+
+    FrameArchive(const FrameArchive&) = delete;
+    FrameArchive& operator=(const FrameArchive&) = delete;
+
+    size_t size() const { return count; }
+    const FrameIndexEntry& entry(size_t i) const { return index[i]; }
+
+    // Index of the frame with the given number, size() when there is none
+    size_t find(uint32_t frame_number) const;
+
+    // Index of the last frame at or before the simulation time, 0 for times before the first
+    size_t seek(double timestamp) const;
+
+    // The stored bytes of frame i in the mapping, valid while the archive is open
+    const uint8_t* bytes(size_t i) const { return data + index[i].offset; }
+    const FrameHeader& header(size_t i) const { return *reinterpret_cast<const FrameHeader*>(bytes(i)); }
+
+    // The triangles of a raw (version 4 or 6) frame in the mapping, ready to upload as they are,
+    // nullptr for compressed frames
+    const Vertex* raw_triangles(size_t i) const;
+
+    // Decodes frame i, decoding its keyframe first unless that was the last one decoded
+    FrameData load(size_t i, bool load_cube_marching = true);
+    void load(size_t i, FrameData& frame, bool load_cube_marching = true);
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particle.h"
+#include "CubeMarch.h"
+
+struct FrameHeader;
+
+// Channels of a version 5 or 6 frame, main_c::frame_channels selects the ones written.
+// Channels left out load as zeros (colors as opaque white). The comments give the version 5
+// encoding, version 6 stores them as float arrays.
+enum FrameChannel : uint32_t {
+    frame_position = 1u << 0,   // 3 x 16 bit, quantized over the FrameEncoding range
+    frame_color = 1u << 1,      // 4 x 8 bit unorm
+    frame_density = 1u << 2,    // Half float
+    frame_velocity = 1u << 3,   // 3 x half float
+    frame_pressure = 1u << 4,   // Half float
+    frame_triangles = 1u << 5,  // 3 x 16 bit position over the same range, 3 x 8 bit snorm normal
+    frame_all_channels = (1u << 6) - 1
+};
+
+#pragma pack(push, 1)
+// Follows the FrameHeader of a version 5 file, packed_bytes of LZ stream (lz.h) follow it
+struct FrameEncoding {
+    uint32_t frame;         // Frame number of this file
+    uint32_t keyframe;      // Frame the positions are delta coded against, frame for a keyframe
+    uint32_t channels;      // FrameChannel bits
+    glm::vec3 range_min;    // Quantization box of positions and triangle vertices
+    glm::vec3 range_max;
+    uint32_t raw_bytes;     // Stream size before compression
+    uint32_t packed_bytes;
+};
+#pragma pack(pop)
+
+// The stream holds each channel as byte planes (all low bytes of a component, then all high
+// bytes), so slowly varying values turn into long runs the LZ stage removes. Keyframe positions
+// are stored as differences to the previous record, delta frames as differences to the
+// keyframe's quantized positions, both modulo 2^16 so decoding is exact.
+class FrameEncoder {
+private:
+    int keyframe = -1;
+    glm::vec3 range_min {0.0f};
+    glm::vec3 range_max {0.0f};
+    std::vector<uint16_t> key_codes;    // Quantized keyframe positions, all x, then y, then z
+    std::vector<uint16_t> codes;
+    std::vector<uint16_t> plane;
+    std::vector<uint8_t> raw;
+
+public:
+    // Appends the FrameEncoding and the compressed stream of a frame to out. Frames must come
+    // in order. A frame is a keyframe every main_c::keyframe_interval frames, and whenever the
+    // particle count changed or a particle left the keyframe's quantization range.
+    void encode(int frame, const FrameHeader& header, const std::vector<Particle_buffer>& particles,
+                const std::vector<Vertex>& triangles, std::vector<uint8_t>& out);
+};
+
+// Decodes version 5 frames, keeping the positions of the last keyframe for the delta frames
+// after it
+class FrameDecoder {
+private:
+    int keyframe = -1;
+    std::vector<uint16_t> key_codes;
+    std::vector<uint16_t> codes;
+    std::vector<uint16_t> plane;
+    std::vector<uint8_t> raw;
+
+public:
+    bool has_keyframe(uint32_t frame) const { return keyframe == static_cast<int>(frame); }
+
+    // Fills particles (and triangles when given) from the packed stream of a frame with the
+    // given header. A delta frame needs has_keyframe(encoding.keyframe), decode that one first.
+    void decode(const FrameHeader& header, const FrameEncoding& encoding, const uint8_t* packed,
+                ParticleStore& particles, std::vector<Vertex>* triangles);
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "frame.h"
+#include "frame_archive.h"
+
+// A frame decoded ahead of playback
+struct PrefetchedFrame {
+    size_t index = 0;                           // Position in the replay, from 0
+    FrameData data;
+    const Vertex* mapped_triangles = nullptr;   // Raw archive frames: the triangles in the mapping, data has none
+};
+
+// Decodes frames 0, 1, ... on a background thread into a ring of depth buffers while the frame
+// handed out last is drawn. Frames come from the archive when one is given and from
+// prefix####.bin otherwise, the first frame that can't be read ends the replay. The buffers
+// are reused, so steady playback decodes without allocating.
+class FramePrefetcher {
+private:
+    FrameArchive* archive;
+    std::string prefix;
+    bool load_cube_marching;
+
+    std::vector<PrefetchedFrame> frames;
+    BoundedQueue<PrefetchedFrame*> free_frames;
+    BoundedQueue<PrefetchedFrame*> ready;
+    PrefetchedFrame* current = nullptr;
+
+    std::atomic<bool> stopping {false};
+    std::thread worker;
+
+    void run();
+
+public:
+    FramePrefetcher(FrameArchive* archive, const std::string& prefix, size_t depth, bool load_cube_marching);
+    ~FramePrefetcher();
+
+    FramePrefetcher(const FramePrefetcher&) = delete;
+    FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+
+    // The next frame, waiting for it when decoding fell behind. The frame handed out before goes
+    // back to the ring. nullptr once the frames ran out.
+    PrefetchedFrame* next();
+};
+
+// Paces playback by FrameHeader::timestamp instead of a fixed sleep. wait(timestamp) returns
+// when that simulation time has come on a clock running at speed simulated seconds per second,
+// started by the first call. A frame late by more than a tenth of a second moves the clock
+// instead of the frames after it being rushed to catch up. speed <= 0 doesn't wait at all.
+class FramePacer {
+private:
+    double speed;
+    bool started = false;
+    std::chrono::steady_clock::time_point origin;   // Wall time of simulation time 0
+
+public:
+    explicit FramePacer(double speed): speed(speed) {}
+
+    void wait(double timestamp);
+};
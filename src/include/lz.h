@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte-oriented LZ77 codec for frame files, in the spirit of LZ4: a stream of sequences, each a
+// token byte (literal count in the high nibble, match length - 4 in the low one, 15 meaning
+// more length bytes follow), the literals, a 16 bit little-endian match offset and the extra
+// match length bytes. The last sequence has literals only. Greedy matching over a 64 KiB window
+// keeps encoding at memory speed, decoding is plain copies.
+namespace lz {
+    // Most bytes compress() can produce for n input bytes
+    size_t bound(size_t n);
+
+    // Appends the compressed form of src[0, n) to out and returns the number of bytes added
+    size_t compress(const uint8_t* src, size_t n, std::vector<uint8_t>& out);
+
+    // Decompresses packed bytes into exactly n bytes at dst, throws std::runtime_error when the
+    // input is corrupt or does not decode to n bytes
+    void decompress(const uint8_t* src, size_t packed, uint8_t* dst, size_t n);
+}
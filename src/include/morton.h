@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Z-order curve over grid cells, 10 bits per axis. Cells are biased so a grid
+// centred on the origin stays in range, coordinates outside wrap around.
+inline uint32_t morton_expand_bits(uint32_t v) {
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+inline uint32_t morton_code(const glm::ivec3& cell) {
+    const uint32_t bias = 1u << 9;
+    return (morton_expand_bits(cell.x + bias) << 2) |
+           (morton_expand_bits(cell.y + bias) << 1) |
+            morton_expand_bits(cell.z + bias);
+}
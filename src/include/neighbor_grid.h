@@ -4,35 +4,53 @@
 #include <glm/glm.hpp>
 
 #include "particle.h"
+#include "cell_buckets.h"
+#include "thread_pool.h"
 
+// Dense uniform grid over the box [-lx, lx] x [-ly, ly] x [-lz, lz]. Every cell
+// has its own bucket, so there are no collisions and no modulo. Positions outside
+// the box are clamped into the border cells, which keeps the 27-cell search exact.
 class NeighborGrid {
 private:
-    float m_cellSize;       // Typically 2x smoothing length (h)
-    uint32_t m_tableSize;   // Prime number for better distribution
-    uint32_t* m_particleTable;
-    std::vector<Particle*> m_sortedParticles;
-
-    const glm::vec3 grid_pos;
-    const float nx;
-    const float ny;
-    const float nz;
+    float m_cellSize;
+    glm::vec3 m_origin;
+    glm::ivec3 m_dims;
+    CellBuckets m_buckets;
+
     const float h;
 
-    float cell_size;
-    std::vector<std::vector<Particle*>> particle_table;
-    
+    glm::ivec3 clampCell(const glm::ivec3& cell) const;
+
 public:
+    static constexpr const char* name = "grid";
+
     uint32_t computeHash(const glm::ivec3& cell) const;
+    uint32_t bucketCount() const { return m_buckets.bucketCount(); }
 
-    NeighborGrid(float cell_sz, float smoothing_dist, float lx, float ly, float lz);
-    // NeighborGrid(float cellSize, float smoothing_dist, uint32_t tableSize = 262144);
-    // ~NeighborGrid();
+    NeighborGrid(float smoothing_dist, float lx, float ly, float lz);
 
     // Prevent copying
     NeighborGrid(const NeighborGrid&) = delete;
     NeighborGrid& operator=(const NeighborGrid&) = delete;
 
-    void build(std::vector<Particle>& particles);
-    void queryNeighbors(glm::vec3 pos, std::vector<Particle*>& neighbors) const;
+    // Buckets the particles by hash_values, which must come from computeHash
+    void build(const ParticleStore& particles, ThreadPool& pool);
+    void queryNeighbors(glm::vec3 pos, std::vector<uint32_t>& neighbors) const;
     glm::ivec3 positionToCell(const glm::vec3& pos) const;
+
+    // Calls visit(index) for every particle in the 27 cells around pos (or within reach cells).
+    // Cells along z are adjacent buckets, so each (dx, dy) row is a single contiguous run of particles.
+    template <typename Visit>
+    void forEachNeighbor(glm::vec3 pos, Visit&& visit, int reach = 1) const {
+        const glm::ivec3 base = positionToCell(pos);
+        const glm::ivec3 lo = glm::max(base - glm::ivec3(reach), glm::ivec3(0));
+        const glm::ivec3 hi = glm::min(base + glm::ivec3(reach), m_dims - glm::ivec3(1));
+
+        for(int x = lo.x; x <= hi.x; ++x) {
+            for(int y = lo.y; y <= hi.y; ++y) {
+                const uint32_t row = (x * m_dims.y + y) * m_dims.z;
+                m_buckets.forEach(row + lo.z, row + hi.z, visit);
+            }
+        }
+    }
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <type_traits>
+
+#include "SpatialHash.h"
+#include "neighbor_grid.h"
+
+// Neighbor search backends SPH, CubeMarch and NeighborTable are templated on.
+// A backend provides:
+//   static constexpr const char* name
+//   glm::ivec3 positionToCell(const glm::vec3& pos) const
+//   uint32_t computeHash(const glm::ivec3& cell) const    bucket key stored in hash_values
+//   uint32_t bucketCount() const                          keys are in [0, bucketCount())
+//   void build(const ParticleStore& particles, ThreadPool& pool)
+//   void forEachNeighbor(glm::vec3 pos, Visit&& visit, int reach = 1) const
+//                                   visit(index) for every candidate in the cells within reach of
+//                                   pos's cell (the 27 around it by default, reach is at most 2)
+//   void queryNeighbors(glm::vec3 pos, std::vector<uint32_t>& out) const
+// Candidates are not pruned by distance, callers check it themselves.
+//
+// SpatialHash works anywhere, NeighborGrid is collision-free but bounded to the tank.
+
+// Both backends are built from the search cell size and the half-extents of the tank
+template <typename Search>
+Search make_neighbor_search(float cell_size, float lx, float ly, float lz) {
+    if constexpr (std::is_same_v<Search, NeighborGrid>) {
+        return Search(cell_size, lx, ly, lz);
+    } else {
+        return Search(cell_size);
+    }
+}
+
+// Picked at configure time, see SPH_NEIGHBOR_SEARCH in CMakeLists.txt
+#if defined(SPH_SEARCH_GRID)
+using SelectedSearch = NeighborGrid;
+#else
+using SelectedSearch = SpatialHash;
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#include "particle.h"
+#include "thread_pool.h"
+
+// Default build filter: every query gets a row and every pair within the radius is kept
+struct AllPairs {
+    bool query(size_t) const { return true; }
+    bool pair(size_t, uint32_t) const { return true; }
+    float radius2(size_t, uint32_t, float radius2) const { return radius2; }
+    int reach(size_t) const { return 1; }
+};
+
+// Compressed sparse row neighbor lists: the neighbors of query q are
+// indices[offsets[q] .. offsets[q + 1]). Only pairs within the search radius
+// are kept, optionally together with the pair distance and x_q - x_j.
+class NeighborTable {
+private:
+    // Per-chunk scratch, kept between builds so steady-state rebuilds reuse capacity. Every chunk
+    // reserves room for the most pairs any chunk has listed (plus a quarter), as particles moving
+    // from one chunk's range to another's would otherwise grow each buffer in turn.
+    std::vector<std::vector<uint32_t>> chunk_indices;
+    std::vector<std::vector<float>> chunk_distances;
+    std::vector<std::vector<glm::vec3>> chunk_deltas;
+    std::vector<uint32_t> chunk_base;
+    size_t chunk_reserve = 0;
+
+public:
+    bool store_distances;
+    bool store_deltas;
+
+    // Filled chunk by chunk on the pool, which also first-touches each chunk's slice
+    aligned_vector<uint32_t> offsets;
+    aligned_vector<uint32_t> indices;
+    aligned_vector<float> distances;
+    aligned_vector<glm::vec3> deltas;
+
+    NeighborTable(bool cache_distances = false, bool cache_deltas = false)
+        : store_distances(cache_distances || cache_deltas), store_deltas(cache_deltas) {}
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    uint32_t begin(size_t q) const { return offsets[q]; }
+    uint32_t end(size_t q) const { return offsets[q + 1]; }
+
+    // query_pos(q) gives the position of query q, candidates come from the hash cells around it.
+    // Queries with keep.query(q) false get an empty row, and only pairs with keep.pair(q, j) are
+    // listed (SPH uses it to list every pair once). keep.radius2(q, j, radius2) may change the
+    // squared radius of a pair, and keep.reach(q) how many cells around q are scanned for it.
+    template <typename QueryPos, typename Search, typename Filter = AllPairs>
+    void build(size_t query_count, QueryPos&& query_pos, const glm::vec3* positions,
+               const Search& sp_hash, float radius, ThreadPool& pool, const Filter& keep = {})
+    {
+        const float radius2 = radius * radius;
+
+        chunk_indices.resize(pool.size());
+        chunk_distances.resize(pool.size());
+        chunk_deltas.resize(pool.size());
+        chunk_base.assign(pool.size() + 1, 0);
+        offsets.resize(query_count + 1);
+        offsets[0] = 0;
+
+        // Pass 1: prune candidates into chunk-local buffers, offsets[q + 1] holds the count for now
+        pool.parallel_for(query_count, [&](size_t begin, size_t end, size_t chunk) {
+            auto& idx = chunk_indices[chunk];
+            auto& dist = chunk_distances[chunk];
+            auto& delta = chunk_deltas[chunk];
+            idx.clear();
+            dist.clear();
+            delta.clear();
+            idx.reserve(chunk_reserve);
+            if(store_distances) { dist.reserve(chunk_reserve); }
+            if(store_deltas) { delta.reserve(chunk_reserve); }
+
+            for(size_t q = begin; q < end; q++) {
+                if(!keep.query(q)) {
+                    offsets[q + 1] = 0;
+                    continue;
+                }
+
+                const glm::vec3 xq = query_pos(q);
+                const size_t before = idx.size();
+                sp_hash.forEachNeighbor(xq, [&](uint32_t j) {
+                    if(!keep.pair(q, j)) { return; }
+
+                    const glm::vec3 r_v = xq - positions[j];
+                    const float r2 = glm::dot(r_v, r_v);
+                    if(r2 > keep.radius2(q, j, radius2)) { return; }
+
+                    idx.push_back(j);
+                    if(store_distances) { dist.push_back(std::sqrt(r2)); }
+                    if(store_deltas) { delta.push_back(r_v); }
+                }, keep.reach(q));
+
+                offsets[q + 1] = idx.size() - before;
+            }
+
+            chunk_base[chunk + 1] = idx.size();
+        });
+
+        for(size_t c = 0; c < chunk_base.size() - 1; c++) {
+            if(chunk_base[c + 1] > chunk_reserve) { chunk_reserve = chunk_base[c + 1] + chunk_base[c + 1] / 4; }
+            chunk_base[c + 1] += chunk_base[c];
+        }
+
+        const size_t total = chunk_base.back();
+        indices.resize(total);
+        distances.resize(store_distances ? total : 0);
+        deltas.resize(store_deltas ? total : 0);
+
+        // Pass 2: turn counts into offsets and copy each chunk into place
+        pool.parallel_for(query_count, [&](size_t begin, size_t end, size_t chunk) {
+            uint32_t running = chunk_base[chunk];
+            for(size_t q = begin; q < end; q++) {
+                running += offsets[q + 1];
+                offsets[q + 1] = running;
+            }
+
+            const size_t base = chunk_base[chunk];
+            std::copy(chunk_indices[chunk].begin(), chunk_indices[chunk].end(), indices.begin() + base);
+            if(store_distances) {
+                std::copy(chunk_distances[chunk].begin(), chunk_distances[chunk].end(), distances.begin() + base);
+            }
+            if(store_deltas) {
+                std::copy(chunk_deltas[chunk].begin(), chunk_deltas[chunk].end(), deltas.begin() + base);
+            }
+        });
+    }
+};
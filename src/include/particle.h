@@ -2,6 +2,12 @@
 #define PARTICLE_H
 
 #include <vector>
+#include <cstdint>
+#include <new>
+#include <numeric>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
 #include <glm/glm.hpp>
 
 #pragma pack(push, 1) // No padding
@@ -14,43 +20,131 @@ struct Particle_buffer {
 };
 #pragma pack(pop)
 
-struct Particle {
-    glm::vec3 position;
-    glm::vec4 color;   
-    glm::vec3 velocity;
-    glm::vec3 acceleration;
-    float density;
-    float pressure;
-    uint32_t hash_value;
-
-    std::vector<Particle*> neighbors;  
-
-    Particle() = default;
-
-    Particle(const Particle& p)
-        : position(p.position),
-          color(p.color),
-          velocity(p.velocity),
-          acceleration(p.acceleration),
-          density(p.density),
-          pressure(p.pressure),
-          hash_value(p.hash_value),
-          neighbors() {}
-
-    Particle& operator=(const Particle& p) {
-        position = p.position;
-        color = p.color;   
-        velocity = p.velocity;
-        acceleration = p.acceleration;
-        density = p.density;
-        pressure = p.pressure;
-        hash_value = p.hash_value;
-
-        return *this;
+// Cache-line aligned allocator so every per-particle array starts on its own line.
+// resize(n) default-initialises, so trivial elements are left unwritten and each page is first
+// touched (and placed on a NUMA node) by the thread that fills it.
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* ptr, std::size_t) { ::operator delete(ptr, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    void construct(U* ptr) noexcept(std::is_nothrow_default_constructible_v<U>) { ::new(static_cast<void*>(ptr)) U; }
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) { ::new(static_cast<void*>(ptr)) U(std::forward<Args>(args)...); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+// Structure-of-arrays particle storage, every field is addressed by particle index
+struct ParticleStore {
+    aligned_vector<glm::vec3> positions;
+    aligned_vector<glm::vec4> colors;
+    aligned_vector<glm::vec3> velocities;
+    aligned_vector<glm::vec3> accelerations;
+    aligned_vector<float> densities;
+    aligned_vector<float> pressures;
+    aligned_vector<uint32_t> hash_values;
+    aligned_vector<uint32_t> ids;   // Creation index, survives reordering
+    aligned_vector<uint8_t> levels; // Adaptive resolution level, see SPH::adapt_resolution()
+
+    std::size_t size() const { return positions.size(); }
+
+    // A particle of level l stands for 2^l base particles
+    float mass_scale(std::size_t i) const { return static_cast<float>(1u << levels[i]); }
+
+    template <typename Func>
+    void for_each_array(Func&& f) {
+        f(positions);
+        f(colors);
+        f(velocities);
+        f(accelerations);
+        f(densities);
+        f(pressures);
+        f(hash_values);
+        f(ids);
+        f(levels);
+    }
+
+    void resize(std::size_t count) {
+        positions.assign(count, glm::vec3(0.0f));
+        colors.assign(count, glm::vec4(0.0f));
+        velocities.assign(count, glm::vec3(0.0f));
+        accelerations.assign(count, glm::vec3(0.0f));
+        densities.assign(count, 0.0f);
+        pressures.assign(count, 0.0f);
+        hash_values.assign(count, 0);
+        ids.resize(count);
+        std::iota(ids.begin(), ids.end(), 0u);
+        levels.assign(count, 0);
+    }
+
+    // Same as resize(count), but the arrays are reallocated and filled chunk by chunk on the
+    // pool, so every page lands on the node of the thread that works on that index range
+    template <typename Pool>
+    void resize(std::size_t count, Pool& pool) {
+        for_each_array([count](auto& a) {
+            std::decay_t<decltype(a)> fresh;
+            fresh.resize(count);
+            a.swap(fresh);
+        });
+
+        pool.parallel_for(count, [this](std::size_t begin, std::size_t end) {
+            std::fill(positions.begin() + begin, positions.begin() + end, glm::vec3(0.0f));
+            std::fill(colors.begin() + begin, colors.begin() + end, glm::vec4(0.0f));
+            std::fill(velocities.begin() + begin, velocities.begin() + end, glm::vec3(0.0f));
+            std::fill(accelerations.begin() + begin, accelerations.begin() + end, glm::vec3(0.0f));
+            std::fill(densities.begin() + begin, densities.begin() + end, 0.0f);
+            std::fill(pressures.begin() + begin, pressures.begin() + end, 0.0f);
+            std::fill(hash_values.begin() + begin, hash_values.begin() + end, 0u);
+            std::iota(ids.begin() + begin, ids.begin() + end, static_cast<uint32_t>(begin));
+            std::fill(levels.begin() + begin, levels.begin() + end, 0);
+        });
     }
 
-    Particle(Particle&&) = default;
-    Particle& operator=(Particle&&) = default;
+    // Moves particle order[i] to slot i in every array, and in any extra per-particle
+    // arrays the caller keeps. The permutation is applied in place by walking its
+    // cycles with swaps, visited is caller-owned scratch.
+    template <typename... Extra>
+    void permute(const std::vector<uint32_t>& order, std::vector<uint8_t>& visited, Extra&... extra) {
+        visited.assign(size(), 0);
+
+        for(std::size_t start = 0; start < size(); start++) {
+            if(visited[start]) { continue; }
+
+            std::size_t j = start;
+            visited[j] = 1;
+            while(order[j] != start) {
+                const std::size_t k = order[j];
+                const auto swap = [j, k](auto& a) { std::swap(a[j], a[k]); };
+                for_each_array(swap);
+                (swap(extra), ...);
+                visited[k] = 1;
+                j = k;
+            }
+        }
+    }
 };
 
 #endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+// Triangle soup of a collider mesh, three vertices per triangle
+struct TriangleMesh {
+    std::vector<glm::vec3> vertices;
+
+    size_t triangle_count() const { return vertices.size() / 3; }
+};
+
+// Reads the v / f records of a Wavefront OBJ file, polygons are split into fans
+TriangleMesh load_obj(const std::string& path);
+
+// Exact signed distances to primitives, negative inside the solid
+namespace sdf {
+    float box(const glm::vec3& p, const glm::vec3& center, const glm::vec3& half_extent);
+    float sphere(const glm::vec3& p, const glm::vec3& center, float radius);
+
+    // Inside of an axis-aligned tank without a lid: distance to the nearest wall or the floor,
+    // positive in the fluid
+    float open_box(const glm::vec3& p, const glm::vec3& half_extent);
+}
+
+// Colliders baked into a voxel grid of signed distances, positive where fluid may be and
+// negative inside solids. Lookups interpolate the 8 surrounding samples, so the boundary pass
+// costs the same for any geometry. Points outside the grid take the value at the nearest point
+// on it, which extends the walls at the grid faces straight out (e.g. above an open tank).
+class SignedDistanceField {
+public:
+    glm::vec3 origin {0.0f};    // Position of sample (0, 0, 0)
+    float spacing = 1.0f;
+    int nx = 0;
+    int ny = 0;
+    int nz = 0;
+    std::vector<float> values;  // x-major, z fastest
+
+    SignedDistanceField() = default;
+
+    // Samples covering [lo, hi], the grid is aligned so its last sample sits on hi
+    SignedDistanceField(const glm::vec3& lo, const glm::vec3& hi, float spacing);
+
+    size_t index(int i, int j, int k) const { return (static_cast<size_t>(i) * ny + j) * nz + k; }
+    glm::vec3 position(int i, int j, int k) const { return origin + spacing * glm::vec3(i, j, k); }
+    bool empty() const { return values.empty(); }
+
+    // Sets every sample to phi(position), or to min(current, phi) to add a solid
+    template <typename Phi>
+    void fill(Phi&& phi, ThreadPool& pool, bool combine = false) {
+        pool.parallel_for(static_cast<size_t>(nx), [&](size_t begin, size_t end) {
+            for(int i = begin; i < static_cast<int>(end); i++) {
+                for(int j = 0; j < ny; j++) {
+                    for(int k = 0; k < nz; k++) {
+                        float& value = values[index(i, j, k)];
+                        const float d = phi(position(i, j, k));
+                        value = combine ? std::min(value, d) : d;
+                    }
+                }
+            }
+        });
+    }
+
+    // Adds a closed mesh as a solid, or with container set makes its inside the only fluid region
+    void add_mesh(const TriangleMesh& mesh, ThreadPool& pool, bool container);
+
+    // Trilinear distance at p, and its gradient (pointing away from the solid) when asked for
+    float sample(const glm::vec3& p, glm::vec3* gradient = nullptr) const;
+
+    // Zero level set as a triangle soup for drawing, marched over the grid cells
+    std::vector<glm::vec3> triangulate() const;
+};
+
+// The scene's colliders: the open tank [-lim, lim] (or the mesh in sph_c::collider_mesh) and
+// the obstacle primitives from sph_consts, sampled every sph_c::sdf_spacing
+SignedDistanceField make_scene_collider(float lim_x, float lim_y, float lim_z, ThreadPool& pool);
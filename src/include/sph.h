@@ -1,17 +1,29 @@
 #pragma once
 #include <vector>
-#include <thread>
 #include <functional>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "SpatialHash.h"
+#include "neighbor_search.h"
+#include "neighbor_table.h"
+#include "sph_simd.h"
+#include "thread_pool.h"
 #include "particle.h"
 #include "sph_consts.h"
+#include "sph_kernels.h"
+#include "sdf.h"
 
+// Neighbor reads of one force evaluation and the ones that cross NUMA nodes, see SPH::numa_traffic()
+struct NumaTraffic {
+    uint64_t reads;
+    uint64_t remote_reads;
+    uint64_t remote_bytes;
+};
+
+// Kernel is one of the policies in sph_kernels.h and Search a backend from
+// neighbor_search.h, every combination is instantiated in sph.cpp
+template <typename Kernel, typename Search>
 class SPH {
 public:
-    const int num_threads;
-
     const float h;
     const float lim_x;
     const float lim_y;
@@ -25,57 +37,270 @@ public:
     const float k = sph_c::k;
     const float mu = sph_c::mu; 
 
+    const bool adaptive_time_step = sph_c::adaptive_time_step;
+    Integrator integrator = sph_c::integrator;
+    Solver solver = sph_c::solver;
+
+    NeighborMode neighbor_mode = sph_c::neighbor_mode;
+    const float neighbor_skin = sph_c::neighbor_skin;
+    const int reorder_interval = sph_c::reorder_interval;
+
     const glm::vec4 box_color = sph_c::box_color;
     const glm::vec3 gravity = sph_c::gravity;
 
-    const float poly6_const = 315 / (64 * glm::pi<float>() * glm::pow(h, 9));
-    const float spikyGrad_const = -45 / (glm::pi<float>() * pow(h, 6));
-    const float viscosityLaplace_const = 45 / (glm::pi<float>() * pow(h, 6));
+    const KernelCoeffs kernel = Kernel::coefficients(h);
+
+    Search& sp_hash;
+    ThreadPool& pool;
 
-    SpatialHash& sp_hash;
+    // Tank walls and obstacles, built from sph_consts before any particle exists
+    SignedDistanceField collider;
 
-    std::vector<Particle> particles;
+    ParticleStore particles;
+    // Batched kernels gather straight from the particle arrays and never read cached pair geometry.
+    // They hard-code the Müller kernels, other policies always take the scalar path.
+    sph_simd::Isa simd_isa = sph_simd::Isa::scalar;
+    sph_simd::KernelParams kernel_params;
+    sph_simd::DensityFn simd_density;
+    sph_simd::ForceFn simd_force;
+
+    // Cached pair geometry goes stale between rebuilds, so it is only kept without a skin
+    NeighborTable neighbors {sph_c::cache_pair_geometry && neighbor_skin == 0, sph_c::cache_pair_geometry && neighbor_skin == 0};
+    aligned_vector<glm::vec3> skin_positions;
+    std::vector<float> chunk_max;
     std::vector<glm::vec3> box_positions;
 
-    SPH(float smoothing_dist, float lx, float ly, float lz, float sp_size, SpatialHash& sh);
+    // Morton reordering scratch, reordered is set when a neighbor update of the last frame
+    // permuted the particles or the frame merged or split any
+    std::vector<uint64_t> morton_keys;
+    std::vector<uint32_t> morton_order;
+    std::vector<uint8_t> permute_visited;
+    int steps_since_reorder = 0;
+    bool reordered = false;
+
+    // PBF state: positions at the start of the substep (permuted along with the particles),
+    // per-particle lambdas and the position / velocity corrections of the current pass
+    aligned_vector<glm::vec3> pbf_prev_positions;
+    aligned_vector<float> pbf_lambdas;
+    aligned_vector<glm::vec3> pbf_corrections;
+    float pbf_rho0 = sph_c::pbf_rest_density;
+
+    // Symmetric pair passes: per-chunk accumulation buffers, zero outside a pass, and the range
+    // [pair_begin, pair_end) of particles each chunk wrote to
+    bool symmetric_pairs = sph_c::symmetric_pairs;
+    std::vector<aligned_vector<float>> pair_density;
+    std::vector<aligned_vector<glm::vec3>> pair_force;
+    std::vector<uint32_t> pair_begin;
+    std::vector<uint32_t> pair_end;
+
+    // Sleeping particles: quiet_steps counts the substeps a particle has been still (sleep_steps means
+    // asleep), sleep_densities holds its density at the last check. awake lists the indices the
+    // passes run over while anyone sleeps, disturbed flags the buckets next to fast particles.
+    const int sleep_steps = sph_c::sleep_steps;
+    aligned_vector<uint16_t> quiet_steps;
+    aligned_vector<float> sleep_densities;
+    std::vector<uint32_t> awake;
+    std::vector<uint32_t> awake_next;
+    std::vector<uint32_t> awake_counts;
+    std::vector<uint8_t> disturbed;
+    std::vector<uint32_t> disturbed_buckets;
+    size_t sleeping = 0;
+
+    // Adaptive resolution: kernel coefficients for every pair of levels, the free surface flags
+    // of the last adaptation (on it, or within the support of a particle on it) and its scratch
+    const int adaptive_levels = sph_c::adaptive_levels;
+    std::vector<KernelCoeffs> level_kernels;
+    aligned_vector<uint8_t> surface;
+    aligned_vector<uint8_t> near_surface;
+    int frames_since_adapt = 0;
+    std::vector<uint8_t> removed;
+    std::vector<uint32_t> split_parents;
+
+    // Particles [owned_count(), size()) are halo copies owned by another process (see
+    // domain_decomposition.h). They are searched and enter density and forces, but are left out
+    // of the time step limit and never reordered.
+    size_t halo_count = 0;
+
+    // Leapfrog reuses the accelerations from the end of the previous step
+    bool forces_valid = false;
+    float last_dt = 0.0f;
+    int last_substeps = 0;
+
+    // Simulation time reached and output frames advanced so far. Substeps don't stop at frame
+    // ends, so time runs up to one substep ahead of frames_advanced * delta_time.
+    double time = 0.0;
+    uint64_t frames_advanced = 0;
+
+    SPH(float smoothing_dist, float lx, float ly, float lz, float sp_size, Search& sh, ThreadPool& tp);
 
     void initialize_particles_sphere(int count, glm::vec3 center, float radius);
     void initialize_particles_cube(glm::vec3 center, float side_length, float spacing);
+    static size_t cube_particle_count(float side_length, float spacing);
 
-    void update_hash(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end);
-    void update_properties(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end);
-    void calculate_forces(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end);
-    void update_state(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end);
-    void update_neighbors(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end);
-    void boundary_conditions(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end);
-    void create_cuboid();
+    void update_hash(size_t begin, size_t end);
+    void update_properties(size_t begin, size_t end);
+    void calculate_forces(size_t begin, size_t end);
+    void update_state(size_t begin, size_t end, float dt);
+    void kick(size_t begin, size_t end, float dt);
+    void drift(size_t begin, size_t end, float dt);
+    void compute_forces();
+    bool use_pairs() const;
+    void pair_densities();
+    void pair_forces();
+    template <typename Buffer, typename Reduce>
+    void reduce_pairs(std::vector<Buffer>& buffers, Reduce&& reduce);
+    float time_step_limit();
+    int advance_frame();
 
-    float poly6(glm::vec3 r_v, float h);
-    glm::vec3 spiky_grad(glm::vec3 r_v, float h);
-    float viscosity_laplace(glm::vec3 r_v, float h);
+    void pbf_step(float dt);
+    void pbf_predict(size_t begin, size_t end, float dt);
+    void pbf_lambda(size_t begin, size_t end);
+    void pbf_position_correction(size_t begin, size_t end);
+    void pbf_update_velocity(size_t begin, size_t end, float dt);
+    void pbf_xsph_viscosity(size_t begin, size_t end);
+    void apply_corrections(size_t begin, size_t end, aligned_vector<glm::vec3>* target);
+    void update_neighbors();
+    void update_sleep();
+    int adapt_resolution();
+    void flag_surface(size_t begin, size_t end);
+    void flag_near_surface(size_t begin, size_t end);
+    void update_activity(size_t begin, size_t end);
+    void wake_disturbed();
+    void collect_awake();
+    void wake_all();
+    void particles_changed();
+    NumaTraffic numa_traffic();
+    bool update_neighbor_search();
+    float max_displacement();
+    void reorder_particles();
+    void boundary_conditions(size_t begin, size_t end);
+    void create_container();
+    void set_neighbor_mode(NeighborMode mode);
+    void set_solver(Solver s);
+    void set_simd_isa(sph_simd::Isa isa);
 
-    template <typename Func, typename... Args>
-    void parallel(Func&& func, Args&&... args) {
-        int total = particles.size();
-        int chunk = (total + num_threads - 1) / num_threads;
+    size_t owned_count() const { return particles.size() - halo_count; }
 
-        std::vector<std::thread> threads;
+    // Kernel of the pair (i, j) at the shorter smoothing length of both, so no pair reaches
+    // further than either particle's own h, and the mass of j
+    const KernelCoeffs& pair_kernel(size_t i, size_t j) const {
+        if(adaptive_levels == 0) { return kernel; }
+        return level_kernels[particles.levels[i] * (adaptive_levels + 1) + particles.levels[j]];
+    }
+    float mass_of(size_t j) const { return adaptive_levels == 0 ? mass : mass * particles.mass_scale(j); }
 
-        for(int i = 0; i < num_threads; i++) {
-            auto begin = particles.begin() + i * chunk;
-            auto end = particles.begin() + std::min((i + 1) * chunk, total);
+    // Search cells (of size h + neighbor_skin) around i that hold every neighbor of i
+    int search_reach(size_t i) const {
+        if(adaptive_levels == 0) { return 1; }
+        return static_cast<int>(std::ceil((pair_kernel(i, i).h + neighbor_skin) / (h + neighbor_skin) - 1e-4f));
+    }
+    bool asleep(size_t i) const { return sleeping > 0 && quiet_steps[i] >= sleep_steps; }
 
-            if(begin - particles.begin() >= total) { break; }
+    // Number of particles the passes run over and the index of the a-th one
+    size_t awake_count() const { return sleeping > 0 ? awake.size() : particles.size(); }
+    size_t awake_index(size_t a) const { return sleeping > 0 ? awake[a] : a; }
 
-            threads.emplace_back(
-                [this, begin, end, &func, &args...]() {
-                    std::invoke(func, this, begin, end, std::forward<Args>(args)...);
-                }
-            );
+    // Neighbor table rows: none for sleepers, and with pairs only j > i plus sleeping j
+    // (their own rows are empty) so every pair with an awake particle is listed once.
+    // With adaptive resolution a pair is only listed within its own smoothing length.
+    struct RowFilter {
+        const SPH* sph;
+        bool upper_only;
+
+        bool query(size_t q) const { return !sph->asleep(q); }
+        bool pair(size_t q, uint32_t j) const { return !upper_only || j > q || sph->asleep(j); }
+        int reach(size_t q) const { return sph->search_reach(q); }
+        float radius2(size_t q, uint32_t j, float radius2) const {
+            if(sph->adaptive_levels == 0) { return radius2; }
+            const float r = sph->pair_kernel(q, j).h + sph->neighbor_skin;
+            return r * r;
+        }
+    };
+
+    // Calls visit(j, x_i - x_j, |x_i - x_j|) for every neighbor j within the pair's smoothing length
+    template <typename Visit>
+    void for_each_neighbor(size_t i, Visit&& visit) const {
+        const glm::vec3* pos = particles.positions.data();
+
+        if(neighbor_mode == NeighborMode::stencil) {
+            sp_hash.forEachNeighbor(pos[i], [&](uint32_t j) {
+                const glm::vec3 r_v = pos[i] - pos[j];
+                const float r2 = glm::dot(r_v, r_v);
+                const float h_ij = pair_kernel(i, j).h;
+                if(r2 <= h_ij * h_ij) { visit(j, r_v, std::sqrt(r2)); }
+            }, search_reach(i));
+            return;
+        }
+
+        for(uint32_t n = neighbors.begin(i); n < neighbors.end(i); n++) {
+            const uint32_t j = neighbors.indices[n];
+            if(neighbors.store_deltas) {
+                visit(j, neighbors.deltas[n], neighbors.distances[n]);
+            } else {
+                const glm::vec3 r_v = pos[i] - pos[j];
+                const float r2 = glm::dot(r_v, r_v);
+                const float h_ij = pair_kernel(i, j).h;
+                if(r2 <= h_ij * h_ij) { visit(j, r_v, std::sqrt(r2)); }
+            }
+        }
+    }
+
+    // Calls visit(j, x_i - x_j, |x_i - x_j|) for every neighbor j > i as above, so each pair is seen once.
+    // Sleepers are never visited as i, so an awake i also gets every sleeping j.
+    // In lists mode the table only holds those pairs when use_pairs() is on.
+    template <typename Visit>
+    void for_each_pair(size_t i, Visit&& visit) const {
+        if(neighbor_mode == NeighborMode::stencil) {
+            for_each_neighbor(i, [&](uint32_t j, const glm::vec3& r_v, float r) {
+                if(j > i || asleep(j)) { visit(j, r_v, r); }
+            });
+            return;
+        }
+
+        for_each_neighbor(i, visit);
+    }
+
+    // Largest value(i) over the owned particles, one partial maximum per pool chunk
+    template <typename Value>
+    float parallel_max(Value&& value) {
+        chunk_max.assign(pool.size(), 0.0f);
+
+        pool.parallel_for(owned_count(), [this, &value](size_t begin, size_t end, size_t chunk) {
+            float m = 0.0f;
+            for(size_t i = begin; i < end; i++) { m = std::max(m, value(i)); }
+            chunk_max[chunk] = m;
+        });
+
+        return *std::max_element(chunk_max.begin(), chunk_max.end());
+    }
+
+    template <typename Func, typename... Args>
+    void parallel(Func&& func, Args&&... args) {
+        pool.parallel_for(particles.size(), [this, &func, &args...](size_t begin, size_t end) {
+            std::invoke(func, this, begin, end, args...);
+        });
+    }
+
+    // Like parallel(), but skips sleepers. The awake list is split evenly over the pool and
+    // every run of consecutive indices in it is passed on as one range.
+    template <typename Func, typename... Args>
+    void parallel_awake(Func&& func, Args&&... args) {
+        if(sleeping == 0) {
+            parallel(func, args...);
+            return;
         }
 
-        for(auto& t: threads) { t.join(); }
+        pool.parallel_for(awake.size(), [this, &func, &args...](size_t begin, size_t end) {
+            size_t a = begin;
+            while(a < end) {
+                size_t b = a + 1;
+                while(b < end && awake[b] == awake[b - 1] + 1) { b++; }
+                std::invoke(func, this, awake[a], awake[b - 1] + 1, args...);
+                a = b;
+            }
+        });
     }
 
 };
 
+using Simulation = SPH<SelectedKernel, SelectedSearch>;
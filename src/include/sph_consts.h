@@ -1,7 +1,28 @@
 #pragma once
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
+// lists: CSR neighbor table built each step, stencil: kernels walk the 27 hash cells directly
+enum class NeighborMode {
+    lists,
+    stencil
+};
+
+// symplectic_euler: v += a dt, x += v dt with forces at the start of the step
+// leapfrog: kick-drift-kick velocity Verlet, one force evaluation per step
+enum class Integrator {
+    symplectic_euler,
+    leapfrog
+};
+
+// wcsph: weakly compressible SPH, pressure from the state equation k (rho - rho0)
+// pbf: Position Based Fluids (Macklin & Müller 2013), density constraints solved on positions
+enum class Solver {
+    wcsph,
+    pbf
+};
+
 namespace main_c {
     extern int width;
     extern int height;
@@ -33,6 +54,26 @@ namespace main_c {
     extern const float iso_value;
 
     extern const float sprite_size;
+
+    extern const int num_threads;
+    extern const bool pin_threads;
+    extern const int processes;
+    extern const bool numa_aware;
+    extern const int numa_report_interval;
+
+    extern const bool arena_huge_pages;
+    extern const int alloc_warmup_frames;
+
+    extern const int max_frames;
+    extern const bool save_pipeline;
+    extern const int pipeline_depth;
+
+    extern const bool frame_compression;
+    extern const uint32_t frame_channels;
+    extern const int keyframe_interval;
+    extern const bool frame_archive;
+    extern const int prefetch_depth;
+    extern const float playback_speed;
 }
 
 namespace sph_c {
@@ -46,4 +87,42 @@ namespace sph_c {
     extern const glm::vec3 gravity;
 
     extern const glm::vec4 box_color;
+
+    extern const float sdf_spacing;
+    extern const char* collider_mesh;
+    extern const bool collider_mesh_container;
+    extern const glm::vec3 obstacle_center;
+    extern const float obstacle_radius;
+
+    extern const NeighborMode neighbor_mode;
+    extern const bool cache_pair_geometry;
+    extern const float neighbor_skin;
+    extern const bool simd_kernels;
+    extern const int reorder_interval;
+    extern const bool symmetric_pairs;
+
+    extern const int sleep_steps;
+    extern const float sleep_velocity;
+    extern const float sleep_density_change;
+    extern const float wake_velocity;
+
+    extern const int adaptive_levels;
+    extern const float surface_offset;
+    extern const int adapt_interval;
+
+    extern const bool adaptive_time_step;
+    extern const Integrator integrator;
+    extern const float cfl_factor;
+    extern const float force_factor;
+    extern const float viscosity_factor;
+    extern const float min_time_step;
+    extern const float max_time_step;
+
+    extern const Solver solver;
+    extern const int pbf_iterations;
+    extern const float pbf_rest_density;
+    extern const float pbf_relaxation;
+    extern const float pbf_tensile_k;
+    extern const float pbf_tensile_dq;
+    extern const float pbf_xsph;
 }
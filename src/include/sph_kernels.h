@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+
+// Smoothing kernels as compile-time policies for SPH<Kernel>. The normalisation
+// constants are constexpr; coefficients(h) folds them with the powers of h once.
+// Every policy has support h and evaluates, for 0 < r <= h and without branches:
+//   W(r)          density kernel
+//   grad(r)       g(r) such that grad W = g(r) * (x_i - x_j)
+//   laplacian(r)  viscosity weight L(r) > 0, force term is mu * m * (v_j - v_i) / rho_j * L(r)
+struct KernelCoeffs {
+    float h;
+    float h2;
+    float inv_h;
+    float w;
+    float grad;
+    float lap;
+};
+
+constexpr float kernel_pi = 3.14159265358979323846f;
+
+// Morris et al. 1997 viscosity term built from the kernel gradient, used by the
+// kernels whose analytic Laplacian changes sign inside the support
+inline float morris_laplacian(const KernelCoeffs& c, float r, float g) {
+    const float r2 = r * r;
+    return -2.0f * g * r2 / (r2 + 0.01f * c.h2);
+}
+
+// Müller et al. 2003: poly6 density, spiky pressure gradient and viscosity Laplacian
+struct MullerKernel {
+    static constexpr const char* name = "muller";
+    static constexpr bool batched_simd = true;
+
+    static constexpr float poly6_norm = 315.0f / (64.0f * kernel_pi);
+    static constexpr float spiky_norm = -45.0f / kernel_pi;
+    static constexpr float viscosity_norm = 45.0f / kernel_pi;
+
+    static KernelCoeffs coefficients(float h) {
+        const float h3 = h * h * h;
+        return {h, h * h, 1.0f / h, poly6_norm / (h3 * h3 * h3), spiky_norm / (h3 * h3), viscosity_norm / (h3 * h3)};
+    }
+
+    static float W(const KernelCoeffs& c, float r) {
+        const float d = std::max(c.h2 - r * r, 0.0f);
+        return c.w * d * d * d;
+    }
+
+    static float grad(const KernelCoeffs& c, float r) {
+        const float d = std::max(c.h - r, 0.0f);
+        return c.grad * d * d / r;
+    }
+
+    static float laplacian(const KernelCoeffs& c, float r) {
+        return c.lap * std::max(c.h - r, 0.0f);
+    }
+};
+
+// Cubic B-spline (Monaghan 1992) on q = r / h, written as 2 a^3 - 8 b^3 with
+// a = max(1 - q, 0) and b = max(1/2 - q, 0) so both branches share one expression
+struct CubicSplineKernel {
+    static constexpr const char* name = "cubic";
+    static constexpr bool batched_simd = false;
+
+    static constexpr float norm = 8.0f / kernel_pi;
+
+    static KernelCoeffs coefficients(float h) {
+        const float h3 = h * h * h;
+        return {h, h * h, 1.0f / h, norm / h3, norm / (h3 * h), 0.0f};
+    }
+
+    static float W(const KernelCoeffs& c, float r) {
+        const float q = r * c.inv_h;
+        const float a = std::max(1.0f - q, 0.0f);
+        const float b = std::max(0.5f - q, 0.0f);
+        return c.w * (2.0f * a * a * a - 8.0f * b * b * b);
+    }
+
+    static float grad(const KernelCoeffs& c, float r) {
+        const float q = r * c.inv_h;
+        const float a = std::max(1.0f - q, 0.0f);
+        const float b = std::max(0.5f - q, 0.0f);
+        return c.grad * (24.0f * b * b - 6.0f * a * a) / r;
+    }
+
+    static float laplacian(const KernelCoeffs& c, float r) {
+        return morris_laplacian(c, r, grad(c, r));
+    }
+};
+
+// Wendland C2 (Wendland 1995, 3D): (1 - q)^4 (1 + 4q), whose gradient needs no division by r
+struct WendlandC2Kernel {
+    static constexpr const char* name = "wendland";
+    static constexpr bool batched_simd = false;
+
+    static constexpr float norm = 21.0f / (2.0f * kernel_pi);
+
+    static KernelCoeffs coefficients(float h) {
+        const float h3 = h * h * h;
+        return {h, h * h, 1.0f / h, norm / h3, -20.0f * norm / (h3 * h * h), 0.0f};
+    }
+
+    static float W(const KernelCoeffs& c, float r) {
+        const float q = r * c.inv_h;
+        const float a = std::max(1.0f - q, 0.0f);
+        const float a2 = a * a;
+        return c.w * a2 * a2 * (1.0f + 4.0f * q);
+    }
+
+    static float grad(const KernelCoeffs& c, float r) {
+        const float a = std::max(1.0f - r * c.inv_h, 0.0f);
+        return c.grad * a * a * a;
+    }
+
+    static float laplacian(const KernelCoeffs& c, float r) {
+        return morris_laplacian(c, r, grad(c, r));
+    }
+};
+
+// Picked at configure time, see SPH_KERNEL in CMakeLists.txt
+#if defined(SPH_KERNEL_CUBIC)
+using SelectedKernel = CubicSplineKernel;
+#elif defined(SPH_KERNEL_WENDLAND)
+using SelectedKernel = WendlandC2Kernel;
+#else
+using SelectedKernel = MullerKernel;
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Batched density and force kernels (poly6, spiky gradient, viscosity Laplacian)
+// over a packed list of neighbor indices. Neighbor data is gathered straight from
+// the ParticleStore arrays, 8 pairs per iteration with AVX2 and 16 with AVX-512.
+// The instruction set is picked at runtime, the scalar versions run everywhere else.
+namespace sph_simd {
+
+enum class Isa {
+    scalar,
+    avx2,
+    avx512
+};
+
+struct KernelParams {
+    float h;
+    float h2;
+    float mass;
+    float mu;
+    float poly6_const;
+    float spikyGrad_const;
+    float viscosityLaplace_const;
+};
+
+struct ForceSums {
+    glm::vec3 pressure;
+    glm::vec3 viscosity;
+};
+
+// Unnormalised density: sum of mass * poly6 over the listed neighbors within h
+using DensityFn = float (*)(const KernelParams& kp, const glm::vec3* pos, glm::vec3 xi,
+                            const uint32_t* idx, uint32_t count);
+
+// Pressure and viscosity force sums for particle i, pairs with r = 0, r > h or rho_j = 0 are skipped
+using ForceFn = ForceSums (*)(const KernelParams& kp, const glm::vec3* pos, const glm::vec3* vel,
+                              const float* rho, const float* prs, size_t i,
+                              const uint32_t* idx, uint32_t count);
+
+Isa detect();
+const char* name(Isa isa);
+
+DensityFn density_kernel(Isa isa);
+ForceFn force_kernel(Isa isa);
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <type_traits>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+// Long-lived worker threads shared by SPH and CubeMarch. parallel_for splits
+// [0, total) into one contiguous chunk per thread (the caller runs chunks too)
+// and returns once every chunk has finished, so it behaves like a barrier.
+// Calls must not be nested inside another parallel_for body. Several threads may call it
+// at once, their jobs then run one after the other.
+//
+// With numa_aware the threads are spread over the NUMA nodes in blocks, each pinned to the
+// CPUs of its node, and chunk i always runs on worker i. Index ranges then stay on one node
+// from step to step, so memory first touched by a chunk is local to the thread using it. The
+// caller runs no chunks in this mode, so any thread may submit without being pinned.
+class ThreadPool {
+private:
+    struct Job {
+        void (*run)(void* ctx, size_t chunk, size_t begin, size_t end);
+        void* ctx;
+        size_t total;
+        size_t chunks;
+        size_t chunk_size;
+
+        std::atomic<size_t> next {0};
+        std::atomic<size_t> remaining {0};
+        std::atomic<int> users {0};
+    };
+
+    std::vector<std::thread> workers;
+    int thread_count;
+    bool static_chunks;
+    int node_count;
+    std::vector<int> thread_node;
+
+    std::mutex submit_mutex;
+    std::mutex mutex;
+    std::condition_variable job_cv;
+    std::condition_variable done_cv;
+
+    Job* current_job;
+    uint64_t generation;
+    bool stopping;
+
+    void worker_loop(int index);
+    void run_chunks(Job& job, int index);
+    void execute(Job& job);
+
+    // Number and size of the chunks parallel_for(total) runs
+    std::pair<size_t, size_t> split(size_t total) const {
+        size_t chunks = std::min<size_t>(thread_count, total);
+        const size_t chunk_size = (total + chunks - 1) / chunks;
+        chunks = (total + chunk_size - 1) / chunk_size;
+        return {chunks, chunk_size};
+    }
+
+public:
+    // thread_count <= 0 uses std::thread::hardware_concurrency()
+    explicit ThreadPool(int thread_count = 0, bool pin_threads = false, bool numa_aware = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return thread_count; }
+    int nodes() const { return node_count; }
+
+    // NUMA node of the thread that runs index of parallel_for(total), only stable with numa_aware
+    int node_of(size_t index, size_t total) const { return thread_node[index / split(total).second]; }
+
+    // func(begin, end) or func(begin, end, chunk) with chunk < size()
+    template <typename Func>
+    void parallel_for(size_t total, Func&& func) {
+        if(total == 0) { return; }
+
+        using F = std::remove_reference_t<Func>;
+
+        Job job;
+        job.ctx = (void*) &func;
+        job.total = total;
+        std::tie(job.chunks, job.chunk_size) = split(total);
+        job.run = [](void* ctx, size_t chunk, size_t begin, size_t end) {
+            F& f = *static_cast<F*>(ctx);
+            if constexpr (std::is_invocable_v<F&, size_t, size_t, size_t>) {
+                f(begin, end, chunk);
+            } else {
+                f(begin, end);
+            }
+        };
+
+        execute(job);
+    }
+};
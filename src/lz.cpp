@@ -0,0 +1,119 @@
+#include "lz.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static constexpr size_t min_match = 4;
+static constexpr size_t max_offset = 65535;
+static constexpr int hash_bits = 16;
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+// Lengths of 15 and more continue in bytes of 255 and a final byte below it
+static void write_length(std::vector<uint8_t>& out, size_t length) {
+    for(; length >= 255; length -= 255) { out.push_back(255); }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+static void write_sequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literal_count,
+                           size_t offset, size_t match_length) {
+    const size_t match_code = match_length ? match_length - min_match : 0;
+    out.push_back(static_cast<uint8_t>((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15)));
+    if(literal_count >= 15) { write_length(out, literal_count - 15); }
+    out.insert(out.end(), literals, literals + literal_count);
+
+    if(match_length == 0) { return; }
+    out.push_back(static_cast<uint8_t>(offset & 0xff));
+    out.push_back(static_cast<uint8_t>(offset >> 8));
+    if(match_code >= 15) { write_length(out, match_code - 15); }
+}
+
+size_t lz::bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz::compress(const uint8_t* src, size_t n, std::vector<uint8_t>& out) {
+    const size_t start = out.size();
+    out.reserve(start + bound(n));
+
+    // Position + 1 of the last occurrence of each hashed 4 byte sequence, 0 for none
+    std::vector<uint32_t> table(size_t(1) << hash_bits, 0);
+
+    size_t anchor = 0;
+    size_t i = 0;
+    while(n >= min_match && i + min_match <= n) {
+        const uint32_t v = read32(src + i);
+        uint32_t& slot = table[hash4(v)];
+        const size_t candidate = slot;
+        slot = static_cast<uint32_t>(i + 1);
+
+        if(candidate == 0 || i - (candidate - 1) > max_offset || read32(src + candidate - 1) != v) {
+            i++;
+            continue;
+        }
+
+        const size_t match = candidate - 1;
+        size_t length = min_match;
+        while(i + length < n && src[match + length] == src[i + length]) { length++; }
+
+        write_sequence(out, src + anchor, i - anchor, i - match, length);
+        i += length;
+        anchor = i;
+    }
+
+    write_sequence(out, src + anchor, n - anchor, 0, 0);
+    return out.size() - start;
+}
+
+static size_t read_length(const uint8_t*& src, const uint8_t* end, size_t length) {
+    if(length < 15) { return length; }
+    uint8_t b;
+    do {
+        if(src >= end) { throw std::runtime_error("Truncated LZ stream"); }
+        b = *src++;
+        length += b;
+    } while(b == 255);
+    return length;
+}
+
+void lz::decompress(const uint8_t* src, size_t packed, uint8_t* dst, size_t n) {
+    const uint8_t* end = src + packed;
+    size_t out = 0;
+
+    while(src < end) {
+        const uint8_t token = *src++;
+
+        const size_t literals = read_length(src, end, token >> 4);
+        if(literals > static_cast<size_t>(end - src) || literals > n - out) {
+            throw std::runtime_error("Corrupt LZ literals");
+        }
+        std::memcpy(dst + out, src, literals);
+        src += literals;
+        out += literals;
+
+        // The final sequence stops after its literals
+        if(src == end) { break; }
+
+        if(end - src < 2) { throw std::runtime_error("Truncated LZ stream"); }
+        const size_t offset = src[0] | (size_t(src[1]) << 8);
+        src += 2;
+        const size_t length = read_length(src, end, token & 15) + min_match;
+        if(offset == 0 || offset > out || length > n - out) { throw std::runtime_error("Corrupt LZ match"); }
+
+        // Byte by byte, matches may overlap their own output
+        const uint8_t* from = dst + out - offset;
+        for(size_t k = 0; k < length; k++) { dst[out + k] = from[k]; }
+        out += length;
+    }
+
+    if(out != n) { throw std::runtime_error("LZ stream has the wrong size"); }
+}
@@ -6,14 +6,20 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "SpatialHash.h"
+#include "neighbor_search.h"
+#include "alloc_counter.h"
 #include "shader.h"
 #include "particle.h"
 #include "camera.h"
 #include "sph.h"
 #include "frame.h"
+#include "frame_archive.h"
+#include "frame_prefetch.h"
 #include "CubeMarch.h"
+#include "batch.h"
+#include "domain_decomposition.h"
 #include "sph_consts.h"
+#include "thread_pool.h"
 
 #include <thread>
 #include <chrono>
@@ -31,94 +37,16 @@ enum class RenderMode {
     load
 };
 
-// std::tuple<FrameHeader, std::vector<Particle_buffer> , std::vector<glm::vec3>>
-// load_frame_data(const std::string& filename) {
-    std::tuple<FrameHeader, std::vector<Particle>, std::vector<Vertex>>
-    load_frame_data(const std::string& filename, bool load_cube_marching = true){
-    std::ifstream in(filename, std::ios::binary);
-    if (!in) throw std::runtime_error("Can't open " + filename);
+// Particle VBO holds capacity positions followed by capacity colors, adaptive resolution
+// only ever has fewer particles than the scene started with
+void upload_particles(GLuint vbo, const ParticleStore& particles, size_t capacity, bool upload_colors = false) {
+    const size_t count = std::min(particles.size(), capacity);
 
-    // Read header
-    FrameHeader header;
-    in.read(reinterpret_cast<char*>(&header), sizeof(FrameHeader));
-    
-    // Validate
-    if (std::string(header.magic, 3) != "SPH") 
-        throw std::runtime_error("Invalid file format");
-    if (header.version != 3)
-        throw std::runtime_error("Unsupported version");
-
-    // Read particles
-    std::vector<Particle> particles(header.particle_count);
-    in.read(reinterpret_cast<char*>(particles.data()), 
-           header.particle_count * sizeof(Particle));
-
-    // std::vector<glm::vec3> triangles(header.triangle_count);
-    // in.read(reinterpret_cast<char*>(triangles.data()), header.triangle_count * sizeof(glm::vec3));
-    std::vector<Vertex> triangles;
-    if (load_cube_marching && header.triangle_count > 0) {
-        triangles.resize(header.triangle_count);
-        in.read(reinterpret_cast<char*>(triangles.data()), header.triangle_count * sizeof(Vertex));
-    }
-
-    return {header, particles, triangles};
-}
-
-// void save_frame_data(SPH& sph, std::unique_ptr<CubeMarch>& cm, int frame_number, const Camera& cam, 
-//     const std::string& prefix = "../frames_marchoffphongoff/frame_") {
-    void save_frame_data(SPH& sph, std::unique_ptr<CubeMarch>& cm, int frame_number, const Camera& cam, 
-        const std::string& prefix = "../frames_marchonphongoff/frame_", 
-        bool save_cube_marching = true){
-    std::ostringstream filename;
-    filename << prefix << std::setw(4) << std::setfill('0') << frame_number << ".bin";
-
-    std::ofstream out(filename.str(), std::ios::binary);
-    if (!out) {
-    std::cerr << "Error opening: " << filename.str() << std::endl;
-    return;
-    }
-
-    // Write header
-    FrameHeader header;
-    header.timestamp = frame_number * sph.delta_time;
-    header.particle_count = static_cast<uint32_t>(sph.particles.size());
-    header.h = sph.h;
-    header.dt = sph.delta_time;
-    header.view = cam.view;
-    header.projection = cam.projection;
-    header.gravity = sph.gravity;
-    header.damping_factor = sph.damping_factor;
-    header.box_limits = glm::vec4(sph.lim_x, sph.lim_y, sph.lim_z, 5);
-    
-    // header.cube_len = cm->len_cube;
-    // header.iso_value = cm->iso_value;
-    // header.triangle_count = cm->triangles.size();
-    header.triangle_count = (save_cube_marching) ? cm->triangles.size() : 0;
-
-    out.write(reinterpret_cast<char*>(&header), sizeof(FrameHeader));
-
-    // Write particles
-    // for (const auto& p : sph.particles) {
-    //     Particle_buffer fp;
-    //     fp.position = p.position;
-    //     fp.density = p.density;
-    //     fp.velocity = p.velocity;
-    //     fp.pressure = p.pressure;
-    //     fp.color = p.color;
-    //     out.write(reinterpret_cast<char*>(&fp), sizeof(Particle_buffer));
-    // }
-    for (const auto& p : sph.particles) {
-        Particle p_copy = p;
-        out.write(reinterpret_cast<char*>(&p_copy), sizeof(Particle));
-
-    }
-
-    // out.write(reinterpret_cast<const char*>(cm->triangles.data()), cm->triangles.size() * sizeof(glm::vec3));
-    if (save_cube_marching) {
-        out.write(reinterpret_cast<const char*>(cm->triangles.data()), cm->triangles.size() * sizeof(Vertex));
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::vec3), particles.positions.data());
+    if(upload_colors) {
+        glBufferSubData(GL_ARRAY_BUFFER, capacity * sizeof(glm::vec3), count * sizeof(glm::vec4), particles.colors.data());
     }
-
-    out.close();
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -157,13 +85,15 @@ GLFWwindow* gl_init(const int width, const int height, const char* window_name)
 
 int main(int argc, char* argv[]) {
     if(argc < 4) {
-        std::cerr << "Usage: ./simulator Render Mode:[render|save|load] Remeshing:[true|false] Phong Shading:[true|false]" << std::endl;
+        std::cerr << "Usage: ./simulator Render Mode:[render|save|load] Remeshing:[true|false] Phong Shading:[true|false] [Solver:wcsph|pbf] [Processes]" << std::endl;
         return 1;
     }
 
     std::string mode_s = argv[1];
     std::string march_s = argv[2];
     std::string phong_s = argv[3];
+    std::string solver_s = (argc > 4) ? argv[4] : "";
+    const int process_count = (argc > 5) ? std::atoi(argv[5]) : processes;
     std::string march_status = "";
     std::string phong_status = "";
     if(march_s == "true"){
@@ -201,8 +131,29 @@ int main(int argc, char* argv[]) {
         turnOnPhongShading = true;
     }
 
-    int numThreads = std::thread::hardware_concurrency();
-    std::cout << "Using " << numThreads << " threads\n";
+    // Workers are forked before this process starts any threads or touches GL
+    std::unique_ptr<DomainDecomposition> domain = nullptr;
+    if(process_count > 1) {
+        if(mode != RenderMode::save || solver_s == "pbf" || sph_c::adaptive_levels > 0) {
+            std::cerr << "Multiple processes need save mode, the wcsph solver and uniform resolution" << std::endl;
+            return 1;
+        }
+        domain.reset(new DomainDecomposition{process_count, Simulation::cube_particle_count(cube_side_length, cube_spacing)});
+        std::cout << "Domain split over " << domain->size() << " processes" << std::endl;
+    }
+
+    ThreadPool pool(num_threads, pin_threads, numa_aware);
+    std::cout << "Using " << pool.size() << " threads\n";
+    if(numa_aware) { std::cout << "Threads spread over " << pool.nodes() << " NUMA node(s)\n"; }
+
+    Camera cam {cam_pos, cam_target, cam_up, cam_fov, (float) width, (float) height, cam_near, cam_far};
+
+    // Nothing is drawn in save mode, so it runs without a window, GL context or shaders
+    if(mode == RenderMode::save) {
+        Scene scene {pool, solver_s, turnOnMarchingCubes};
+        run_save_mode(scene, domain.get(), cam, "../frames_" + save_location + "/frame_");
+        return 0;
+    }
 
     GLFWwindow* window = gl_init(width, height, window_name);
 
@@ -215,15 +166,9 @@ int main(int argc, char* argv[]) {
     Shader mShader {"../src/shaders/mVertex.glsl", "../src/shaders/fragment.glsl"};
     Shader phongShader {"../src/shaders/phongvert.glsl", "../src/shaders/phongfrag.glsl"};
 
-    Camera cam {cam_pos, cam_target, cam_up, cam_fov, (float) width, (float) height, cam_near, cam_far};
-    SpatialHash spatialHash(h);
-    SPH sph {h, lim_x, lim_y, lim_z, sprite_size, spatialHash};
-    std::unique_ptr<CubeMarch> cm = nullptr;
-
-    // sph.initialize_particles_sphere(sphere_count, sphere_center, sphere_radius);
-    sph.initialize_particles_cube(cube_center, cube_side_length, cube_spacing);
-    
-    sph.create_cuboid();
+    Scene scene {pool, solver_s, turnOnMarchingCubes};
+    Simulation& sph = scene.sph;
+    std::unique_ptr<SurfaceMesh>& cm = scene.cm;
 
     // SPH Particles
     GLuint VAO, VBO;
@@ -231,14 +176,17 @@ int main(int argc, char* argv[]) {
     glGenBuffers(1, &VBO);
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sph.particles.size() * sizeof(Particle), sph.particles.data(), GL_DYNAMIC_DRAW);
+    const size_t particle_count = sph.particles.size();
+    glBufferData(GL_ARRAY_BUFFER, particle_count * (sizeof(glm::vec3) + sizeof(glm::vec4)), nullptr, GL_DYNAMIC_DRAW);
+    upload_particles(VBO, sph.particles, particle_count, /*upload_colors=*/true);
+    size_t drawn_particles = particle_count;
 
     // Position attribute
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, position));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
     // Color attribute
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, color));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)(particle_count * sizeof(glm::vec3)));
 
     // Container
     GLuint cVAO, cVBO;
@@ -263,7 +211,6 @@ int main(int argc, char* argv[]) {
     glGenBuffers(1, &mVBO);
 
     if(turnOnMarchingCubes) {
-        cm.reset(new CubeMarch{2*lim_x, 2*lim_y, 2*lim_z, len_cube, cm_h, &sph, iso_value, spatialHash});
         int max_triangles = 5 * cm->cells.size();
 
         glBindVertexArray(tVAO);
@@ -298,15 +245,30 @@ int main(int argc, char* argv[]) {
     }
     
     float radius = 5.0f;  // distance from center
-    int frame_number = 0;
-    int max_frames = 1800;
+    int frames_left = max_frames;
+    int sim_frame = 0;
+
+    // Load mode replays the archive when save mode wrote one, the frame files otherwise
+    const std::string frame_prefix = "../frames_" + save_location + "/frame_";
+    std::unique_ptr<FrameArchive> archive;
+    if(mode == RenderMode::load) {
+        try { archive.reset(new FrameArchive(frame_archive_filename(frame_prefix))); }
+        catch(const std::exception& e) { std::cout << e.what() << ", replaying frame files" << std::endl; }
+    }
+    std::unique_ptr<FramePrefetcher> prefetcher;
+    if(mode == RenderMode::load) {
+        prefetcher.reset(new FramePrefetcher(archive.get(), frame_prefix, prefetch_depth, turnOnMarchingCubes));
+    }
+    FramePacer pacer(playback_speed);
+
+    // Raw archive frames upload their triangles straight from the mapping
+    const Vertex* mapped_triangles = nullptr;
+    size_t mapped_count = 0;
 
     // while (!glfwWindowShouldClose(window)) {
-    while(max_frames-- >= 0){
-        std::cout << max_frames <<std::endl;
-        if(mode == RenderMode::render || mode == RenderMode::save) {
-            sph.parallel(&SPH::update_hash);
-            spatialHash.build(sph.particles);
+    while(frames_left-- >= 0){
+        std::cout << frames_left <<std::endl;
+        if(mode == RenderMode::render) {
 
             // float angle = glfwGetTime()/2.0f;
             // cam_pos = glm::vec3(
@@ -316,66 +278,55 @@ int main(int argc, char* argv[]) {
             // )/5.0f;
             // cam.view = glm::lookAt(cam_pos, cam_target, cam_up);
     
-            sph.parallel(&SPH::update_neighbors);
-            if(turnOnMarchingCubes) { cm->parallel(&CubeMarch::update_neighbors); }
 
-            sph.parallel(&SPH::update_properties);
-            sph.parallel(&SPH::calculate_forces);
-            sph.parallel(&SPH::update_state);
-            sph.parallel(&SPH::boundary_conditions);
-            
-            if(turnOnMarchingCubes) { cm->parallel(&CubeMarch::update_color); }
+            step_frame(scene, domain.get(), sim_frame++);
         }
 
         if(mode == RenderMode::load){
-            try {
-                std::ostringstream filename;
-                std::cout << frame_number <<std::endl;
-                filename << "../frames_" << save_location << "/frame_" << std::setw(4) << std::setfill('0') << frame_number++ << ".bin";
-                std::cout << filename.str() <<std::endl;
-                // auto [header, buffer, triangles] = load_frame_data(filename.str());
-                auto [header, buffer, triangles] = load_frame_data(filename.str(), /*load_cube_marching=*/turnOnMarchingCubes);
-                if(turnOnMarchingCubes) { cm->load_triangles(triangles); }
+            // Past the last frame the last one stays on screen
+            if(PrefetchedFrame* frame = prefetcher->next()) {
+                std::cout << frame->index <<std::endl;
+                auto& [header, buffer, triangles] = frame->data;
+                if(turnOnMarchingCubes) {
+                    mapped_triangles = frame->mapped_triangles;
+                    mapped_count = header.triangle_count;
+                    if(!mapped_triangles) { std::swap(cm->triangles, triangles); }
+                }
 
                 // Update buffer
-                glBindBuffer(GL_ARRAY_BUFFER, VBO);
-                glBufferSubData(GL_ARRAY_BUFFER, 0, buffer.size() * sizeof(Particle), buffer.data());
+                pacer.wait(header.timestamp);
+                upload_particles(VBO, buffer, particle_count, /*upload_colors=*/true);
+                drawn_particles = std::min(buffer.size(), particle_count);
 
                 glBindBuffer(GL_ARRAY_BUFFER, cVBO);
                 glBufferSubData(GL_ARRAY_BUFFER, 0, sph.box_positions.size() * sizeof(glm::vec3), sph.box_positions.data());
-                std::this_thread::sleep_for(std::chrono::duration<float>(1.0f / 30.0f));
-    
-            } catch (const std::exception& e) {
-                std::cerr << "Loading failed: " << e.what() << std::endl;
             }
         }
         else if(mode == RenderMode::render){
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sph.particles.size() * sizeof(Particle), sph.particles.data());
+            upload_particles(VBO, sph.particles, particle_count, /*upload_colors=*/sph.reordered);
+            drawn_particles = std::min(sph.particles.size(), particle_count);
 
             glBindBuffer(GL_ARRAY_BUFFER, cVBO);
             glBufferSubData(GL_ARRAY_BUFFER, 0, sph.box_positions.size() * sizeof(glm::vec3), sph.box_positions.data());
 
-            if(turnOnMarchingCubes) { cm->MarchingCubes(); 
+            if(turnOnMarchingCubes) {
+                const uint64_t mesh_allocations = alloc_counter::count();
+                cm->MarchingCubes();
+                check_allocations("Marching cubes", sim_frame, mesh_allocations);
                 // std::cout << "Number of triangles:" << std::endl;
 
                 // std::cout << cm->triangles.size() << std::endl;
             }
 
         }
-        else if(mode == RenderMode::save){
-            // cm->MarchingCubes();
-            if(turnOnMarchingCubes) { cm->MarchingCubes(); }
-            // save_frame_data(sph, cm, frame_number++, cam);
-            save_frame_data(sph, cm, frame_number++, cam, "../frames_"+ save_location+"/frame_", turnOnMarchingCubes);
-            continue;
-        }      
 
         //render cube march stuff  
+        const Vertex* mesh_vertices = mapped_triangles ? mapped_triangles : (turnOnMarchingCubes ? cm->triangles.data() : nullptr);
+        const size_t mesh_count = mapped_triangles ? mapped_count : (turnOnMarchingCubes ? cm->triangles.size() : 0);
         if(turnOnMarchingCubes) {
             glBindVertexArray(tVAO);
             glBindBuffer(GL_ARRAY_BUFFER, tVBO);
-            glBufferData(GL_ARRAY_BUFFER, cm->triangles.size() * sizeof(Vertex), cm->triangles.data(), GL_DYNAMIC_DRAW);
+            glBufferData(GL_ARRAY_BUFFER, mesh_count * sizeof(Vertex), mesh_vertices, GL_DYNAMIC_DRAW);
             // glBufferSubData(GL_ARRAY_BUFFER, 0, cm->triangles.size() * sizeof(glm::vec3), cm->triangles.data());
             
             // Position attribute
@@ -401,7 +352,7 @@ int main(int argc, char* argv[]) {
             shader.setVec2("screen_size", glm::vec2(width, height));
             shader.setFloat("sprite_size", sprite_size);
             glBindVertexArray(VAO);
-            glDrawArrays(GL_POINTS, 0, sph.particles.size());
+            glDrawArrays(GL_POINTS, 0, drawn_particles);
         }
 
         if(turnOnMarchingCubes) {
@@ -411,7 +362,7 @@ int main(int argc, char* argv[]) {
                 cShader.setMatrix("projection", cam.projection);
                 cShader.setVec4("color", glm::vec4(62.0f / 255.0f, 164.0f / 255.0f, 240.0f / 255.0f, 0.8f));
                 glBindVertexArray(tVAO);
-                glDrawArrays(GL_TRIANGLES, 0, cm->triangles.size());
+                glDrawArrays(GL_TRIANGLES, 0, mesh_count);
             } else {
                 phongShader.use();
                 phongShader.setMatrix("view", cam.view);
@@ -421,7 +372,7 @@ int main(int argc, char* argv[]) {
                 phongShader.setVec3("lightColor", glm::vec3(0.5f, 0.5f, 0.5f));
                 phongShader.setVec3("objectColor", glm::vec3(62.0f / 255.0f, 164.0f / 255.0f, 240.0f / 255.0f));
                 glBindVertexArray(tVAO);
-                glDrawArrays(GL_TRIANGLES, 0, cm->triangles.size());
+                glDrawArrays(GL_TRIANGLES, 0, mesh_count);
             }
         }
 
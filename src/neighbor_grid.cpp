@@ -1,56 +1,35 @@
 #include "neighbor_grid.h"
 #include <cmath>
-#include <algorithm>
 
-constexpr uint32_t NO_PARTICLE = 0xFFFFFFFF;
+NeighborGrid::NeighborGrid(float smoothing_dist, float lx, float ly, float lz)
+    : m_cellSize(smoothing_dist), m_origin(-lx, -ly, -lz),
+      m_dims(static_cast<int>(std::ceil(2 * lx / smoothing_dist)) + 1,
+             static_cast<int>(std::ceil(2 * ly / smoothing_dist)) + 1,
+             static_cast<int>(std::ceil(2 * lz / smoothing_dist)) + 1),
+      m_buckets(m_dims.x * m_dims.y * m_dims.z), h(smoothing_dist) {}
 
-NeighborGrid::NeighborGrid(float cell_sz, float smoothing_dist, float lx, float ly, float lz)
-    : cell_size(cell_sz), h(smoothing_dist), grid_pos(-lx, -ly, -lz), nx(2 * lx / cell_sz + 1), ny(2 * ly / cell_sz + 1),
-    nz(2 * lz / cell_sz + 1), particle_table(nx * ny * nz, std::vector<Particle*> {}) {}
+glm::ivec3 NeighborGrid::clampCell(const glm::ivec3& cell) const {
+    return glm::clamp(cell, glm::ivec3(0), m_dims - glm::ivec3(1));
+}
 
 uint32_t NeighborGrid::computeHash(const glm::ivec3& cell) const {
-    return cell.x * ny * nz + cell.y * nz + cell.z;
+    const glm::ivec3 c = clampCell(cell);
+    return (c.x * m_dims.y + c.y) * m_dims.z + c.z;
 }
 
 glm::ivec3 NeighborGrid::positionToCell(const glm::vec3& pos) const {
-    return { (pos - grid_pos) / cell_size };
+    const glm::vec3 local = (pos - m_origin) / m_cellSize;
+    return clampCell({
+        static_cast<int>(std::floor(local.x)),
+        static_cast<int>(std::floor(local.y)),
+        static_cast<int>(std::floor(local.z))
+    });
 }
 
-void NeighborGrid::build(std::vector<Particle>& particles) {
-    for(auto& v: particle_table) { v.clear(); }
-
-    for(auto& p: particles) {
-        particle_table[p.hash_value].push_back(&p);
-    }
+void NeighborGrid::build(const ParticleStore& particles, ThreadPool& pool) {
+    m_buckets.build(particles.hash_values.data(), particles.size(), pool);
 }
 
-void NeighborGrid::queryNeighbors(
-    glm::vec3 pos, std::vector<Particle*>& neighbors) const 
-{
-    float radius = 2 * h;
-
-    const glm::ivec3 baseCell = positionToCell(pos);
-    const int searchRadius = static_cast<int>(std::ceil(radius / m_cellSize));
-
-    for(int dx = -searchRadius; dx <= searchRadius; ++dx) {
-        for(int dy = -searchRadius; dy <= searchRadius; ++dy) {
-            for(int dz = -searchRadius; dz <= searchRadius; ++dz) {
-                const glm::ivec3 cell = baseCell + glm::ivec3(dx, dy, dz);
-                const uint32_t hash = computeHash(cell);
-
-                if(m_particleTable[hash] == NO_PARTICLE) continue;
-
-                // Find particles in this cell
-                uint32_t i = m_particleTable[hash];
-                while(i < m_sortedParticles.size() && 
-                      computeHash(positionToCell(m_sortedParticles[i]->position)) == hash) 
-                {
-                    if(glm::distance(pos, m_sortedParticles[i]->position) <= radius) {
-                        neighbors.push_back(m_sortedParticles[i]);
-                    }
-                    ++i;
-                }
-            }
-        }
-    }
+void NeighborGrid::queryNeighbors(glm::vec3 pos, std::vector<uint32_t>& neighbors) const {
+    forEachNeighbor(pos, [&](uint32_t i) { neighbors.push_back(i); });
 }
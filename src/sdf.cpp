@@ -0,0 +1,276 @@
+#include "sdf.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "CubeMarch.h"
+#include "sph_consts.h"
+
+TriangleMesh load_obj(const std::string& path) {
+    std::ifstream in(path);
+    if(!in) { throw std::runtime_error("Can't open collider mesh " + path); }
+
+    std::vector<glm::vec3> positions;
+    TriangleMesh mesh;
+    std::string line;
+
+    while(std::getline(in, line)) {
+        std::istringstream record(line);
+        std::string type;
+        record >> type;
+
+        if(type == "v") {
+            glm::vec3 v;
+            record >> v.x >> v.y >> v.z;
+            positions.push_back(v);
+        } else if(type == "f") {
+            // Corners look like 7, 7/2 or 7/2/5, negative indices count back from the last vertex
+            std::vector<glm::vec3> polygon;
+            std::string corner;
+            while(record >> corner) {
+                const int index = std::stoi(corner.substr(0, corner.find('/')));
+                const long resolved = index < 0 ? static_cast<long>(positions.size()) + index : index - 1;
+                if(resolved < 0 || resolved >= static_cast<long>(positions.size())) {
+                    throw std::runtime_error("Bad face index in " + path);
+                }
+                polygon.push_back(positions[resolved]);
+            }
+
+            for(size_t c = 2; c < polygon.size(); c++) {
+                mesh.vertices.push_back(polygon[0]);
+                mesh.vertices.push_back(polygon[c - 1]);
+                mesh.vertices.push_back(polygon[c]);
+            }
+        }
+    }
+
+    if(mesh.vertices.empty()) { throw std::runtime_error("No faces in collider mesh " + path); }
+    return mesh;
+}
+
+namespace sdf {
+    float box(const glm::vec3& p, const glm::vec3& center, const glm::vec3& half_extent) {
+        const glm::vec3 q = glm::abs(p - center) - half_extent;
+        return glm::length(glm::max(q, 0.0f)) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+    }
+
+    float sphere(const glm::vec3& p, const glm::vec3& center, float radius) {
+        return glm::length(p - center) - radius;
+    }
+
+    float open_box(const glm::vec3& p, const glm::vec3& half_extent) {
+        const float x = half_extent.x - std::abs(p.x);
+        const float z = half_extent.z - std::abs(p.z);
+        return std::min(std::min(x, z), p.y + half_extent.y);
+    }
+}
+
+// Closest point on triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+static glm::vec3 closest_on_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    const glm::vec3 ab = b - a;
+    const glm::vec3 ac = c - a;
+    const glm::vec3 ap = p - a;
+    const float d1 = glm::dot(ab, ap);
+    const float d2 = glm::dot(ac, ap);
+    if(d1 <= 0.0f && d2 <= 0.0f) { return a; }
+
+    const glm::vec3 bp = p - b;
+    const float d3 = glm::dot(ab, bp);
+    const float d4 = glm::dot(ac, bp);
+    if(d3 >= 0.0f && d4 <= d3) { return b; }
+
+    const float vc = d1 * d4 - d3 * d2;
+    if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) { return a + d1 / (d1 - d3) * ab; }
+
+    const glm::vec3 cp = p - c;
+    const float d5 = glm::dot(ab, cp);
+    const float d6 = glm::dot(ac, cp);
+    if(d6 >= 0.0f && d5 <= d6) { return c; }
+
+    const float vb = d5 * d2 - d1 * d6;
+    if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) { return a + d2 / (d2 - d6) * ac; }
+
+    const float va = d3 * d6 - d5 * d4;
+    if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) { return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b); }
+
+    const float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Whether the ray from p along +axis crosses triangle abc, by projecting onto the other two axes
+static bool ray_crosses(const glm::vec3& p, int axis, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+
+    // Barycentric weights of p in the projected triangle, half-open edges count shared ones once
+    const auto edge = [&](const glm::vec3& e0, const glm::vec3& e1) {
+        return (e1[u] - e0[u]) * (p[v] - e0[v]) - (e1[v] - e0[v]) * (p[u] - e0[u]);
+    };
+    const float w0 = edge(b, c);
+    const float w1 = edge(c, a);
+    const float w2 = edge(a, b);
+    const bool positive = w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f;
+    const bool negative = w0 < 0.0f && w1 < 0.0f && w2 < 0.0f;
+    if(!positive && !negative) { return false; }
+
+    const float area = w0 + w1 + w2;
+    if(area == 0.0f) { return false; }
+
+    const float hit = (w0 * a[axis] + w1 * b[axis] + w2 * c[axis]) / area;
+    return hit > p[axis];
+}
+
+SignedDistanceField::SignedDistanceField(const glm::vec3& lo, const glm::vec3& hi, float s): spacing(s) {
+    const glm::ivec3 counts = glm::ivec3(glm::ceil((hi - lo) / spacing)) + 1;
+    nx = counts.x;
+    ny = counts.y;
+    nz = counts.z;
+    origin = hi - spacing * glm::vec3(counts - 1);
+    values.assign(static_cast<size_t>(nx) * ny * nz, 0.0f);
+}
+
+// Distance to the nearest triangle with the sign of the majority of three axis rays, so a stray
+// hit on a shared edge or a small hole in the mesh does not flip a sample. Every sample tests
+// every triangle, which is fine for the few thousand triangles of a tank.
+void SignedDistanceField::add_mesh(const TriangleMesh& mesh, ThreadPool& pool, bool container) {
+    const std::vector<glm::vec3>& t = mesh.vertices;
+
+    fill([&](const glm::vec3& p) {
+        float nearest = std::numeric_limits<float>::max();
+        int crossings[3] = {0, 0, 0};
+
+        for(size_t v = 0; v < t.size(); v += 3) {
+            const glm::vec3 d = p - closest_on_triangle(p, t[v], t[v + 1], t[v + 2]);
+            nearest = std::min(nearest, glm::dot(d, d));
+            for(int axis = 0; axis < 3; axis++) { crossings[axis] += ray_crosses(p, axis, t[v], t[v + 1], t[v + 2]); }
+        }
+
+        const int odd = (crossings[0] & 1) + (crossings[1] & 1) + (crossings[2] & 1);
+        const bool inside = odd >= 2;
+        const float distance = std::sqrt(nearest);
+        return (inside == container) ? distance : -distance;
+    }, pool, /*combine=*/!container);
+}
+
+float SignedDistanceField::sample(const glm::vec3& p, glm::vec3* gradient) const {
+    const glm::vec3 g = glm::clamp((p - origin) / spacing, glm::vec3(0.0f), glm::vec3(nx - 1, ny - 1, nz - 1));
+    const int i = std::min(static_cast<int>(g.x), nx - 2);
+    const int j = std::min(static_cast<int>(g.y), ny - 2);
+    const int k = std::min(static_cast<int>(g.z), nz - 2);
+    const glm::vec3 f = g - glm::vec3(i, j, k);
+
+    const size_t base = index(i, j, k);
+    const size_t di = static_cast<size_t>(ny) * nz;
+    const size_t dj = nz;
+    const float c000 = values[base];
+    const float c001 = values[base + 1];
+    const float c010 = values[base + dj];
+    const float c011 = values[base + dj + 1];
+    const float c100 = values[base + di];
+    const float c101 = values[base + di + 1];
+    const float c110 = values[base + di + dj];
+    const float c111 = values[base + di + dj + 1];
+
+    // Interpolate along z, then y, then x
+    const float c00 = c000 + f.z * (c001 - c000);
+    const float c01 = c010 + f.z * (c011 - c010);
+    const float c10 = c100 + f.z * (c101 - c100);
+    const float c11 = c110 + f.z * (c111 - c110);
+    const float c0 = c00 + f.y * (c01 - c00);
+    const float c1 = c10 + f.y * (c11 - c10);
+
+    if(gradient) {
+        const float dz0 = (c001 - c000) + f.y * ((c011 - c010) - (c001 - c000));
+        const float dz1 = (c101 - c100) + f.y * ((c111 - c110) - (c101 - c100));
+        *gradient = glm::vec3(c1 - c0, (c01 - c00) + f.x * ((c11 - c10) - (c01 - c00)), dz0 + f.x * (dz1 - dz0)) / spacing;
+    }
+
+    return c0 + f.x * (c1 - c0);
+}
+
+std::vector<glm::vec3> SignedDistanceField::triangulate() const {
+    std::vector<glm::vec3> triangles;
+
+    // Corner order of CubeMarchTables, see CubeMarch::march_cubes
+    static const int corner_offsets[8][3] = {
+        {0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1},
+        {0, 1, 0}, {1, 1, 0}, {1, 1, 1}, {0, 1, 1},
+    };
+
+    for(int i = 0; i + 1 < nx; i++) {
+        for(int j = 0; j + 1 < ny; j++) {
+            for(int k = 0; k + 1 < nz; k++) {
+                glm::vec3 corner_pos[8];
+                float corner_val[8];
+                int table_index = 0;
+
+                for(int m = 0; m < 8; m++) {
+                    const int ci = i + corner_offsets[m][0];
+                    const int cj = j + corner_offsets[m][1];
+                    const int ck = k + corner_offsets[m][2];
+                    corner_pos[m] = position(ci, cj, ck);
+                    corner_val[m] = values[index(ci, cj, ck)];
+                    if(corner_val[m] > 0.0f) { table_index |= (1 << m); }
+                }
+
+                const int edges = CubeMarchTables::edgeTable[table_index];
+                if(edges == 0) { continue; }
+
+                glm::vec3 edge_pos[12];
+                for(int e = 0; e < 12; e++) {
+                    if(!(edges & (1 << e))) { continue; }
+                    const int a = CubeMarchTables::edgeMap[e][0];
+                    const int b = CubeMarchTables::edgeMap[e][1];
+                    const float mu = corner_val[a] / (corner_val[a] - corner_val[b]);
+                    edge_pos[e] = corner_pos[a] + mu * (corner_pos[b] - corner_pos[a]);
+                }
+
+                const int* tri = CubeMarchTables::triTable[table_index];
+                for(int m = 0; tri[m] != -1; m++) { triangles.push_back(edge_pos[tri[m]]); }
+            }
+        }
+    }
+
+    return triangles;
+}
+
+SignedDistanceField make_scene_collider(float lim_x, float lim_y, float lim_z, ThreadPool& pool) {
+    const glm::vec3 lim(lim_x, lim_y, lim_z);
+    const float spacing = sph_c::sdf_spacing;
+    const std::string mesh_path = sph_c::collider_mesh;
+
+    TriangleMesh mesh;
+    if(!mesh_path.empty()) { mesh = load_obj(mesh_path); }
+
+    // A margin of samples around the tank keeps the walls away from the grid faces. The grid
+    // ends at the rim of an open tank, so the walls carry on upwards past it.
+    glm::vec3 lo = -lim - glm::vec3(2.0f * spacing);
+    glm::vec3 hi = lim + glm::vec3(2.0f * spacing);
+    if(mesh_path.empty() || !sph_c::collider_mesh_container) { hi.y = lim.y; }
+
+    for(const glm::vec3& v : mesh.vertices) {
+        lo = glm::min(lo, v - glm::vec3(2.0f * spacing));
+        hi = glm::max(hi, v + glm::vec3(2.0f * spacing));
+    }
+
+    SignedDistanceField field(lo, hi, spacing);
+
+    if(mesh_path.empty() || !sph_c::collider_mesh_container) {
+        field.fill([&](const glm::vec3& p) { return sdf::open_box(p, lim); }, pool);
+    }
+
+    if(!mesh_path.empty()) {
+        field.add_mesh(mesh, pool, sph_c::collider_mesh_container);
+        std::cout << "Collider mesh " << mesh_path << ": " << mesh.triangle_count() << " triangles" << std::endl;
+    }
+
+    if(sph_c::obstacle_radius > 0.0f) {
+        field.fill([](const glm::vec3& p) { return sdf::sphere(p, sph_c::obstacle_center, sph_c::obstacle_radius); }, pool, /*combine=*/true);
+    }
+
+    return field;
+}
@@ -1,36 +1,62 @@
 #include <random>
+#include <algorithm>
+#include <stdexcept>
 
 #include "sph.h"
+#include "morton.h"
 
-SPH::SPH(float smoothing_dist, float lx, float ly, float lz, float sp_size, SpatialHash& sh): h(smoothing_dist),
-    lim_x(lx), lim_y(ly), lim_z(lz), sprite_size(sp_size), sp_hash(sh), num_threads(std::thread::hardware_concurrency()) {}
+template <typename Kernel, typename Search>
+SPH<Kernel, Search>::SPH(float smoothing_dist, float lx, float ly, float lz, float sp_size, Search& sh, ThreadPool& tp): h(smoothing_dist),
+    lim_x(lx), lim_y(ly), lim_z(lz), sprite_size(sp_size), sp_hash(sh), pool(tp),
+    collider(make_scene_collider(lx, ly, lz, tp)) {
 
-void SPH::initialize_particles_sphere(int count, glm::vec3 center, float radius) {
+    const KernelCoeffs muller = MullerKernel::coefficients(h);
+    kernel_params = {h, h * h, mass, mu, muller.w, muller.grad, muller.lap};
+
+    // Level 3 has twice the base h, the most the 5 x 5 x 5 cell searches cover
+    if(adaptive_levels < 0 || adaptive_levels > 3) {
+        throw std::runtime_error("adaptive_levels must be between 0 and 3");
+    }
+    for(int a = 0; a <= adaptive_levels; a++) {
+        for(int b = 0; b <= adaptive_levels; b++) {
+            level_kernels.push_back(Kernel::coefficients(h * std::cbrt(float(1 << std::min(a, b)))));
+        }
+    }
+
+    const bool batched = Kernel::batched_simd && sph_c::simd_kernels;
+    set_simd_isa(batched ? sph_simd::detect() : sph_simd::Isa::scalar);
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::initialize_particles_sphere(int count, glm::vec3 center, float radius) {
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> dist(0.0f, 1.0f);
 
-    particles = std::vector<Particle>(count);
+    particles.resize(count, pool);
+    set_neighbor_mode(neighbor_mode);
+    forces_valid = false;
+    wake_all();
 
-    for(auto& p: particles) {
+    for(int i = 0; i < count; i++) {
         float r = radius * std::cbrt(dist(gen));
         float theta = 2.0f * glm::pi<float>() * dist(gen);
         float phi = std::acos(1.0f - 2.0f * dist(gen));
 
-        p.position = glm::vec3(
+        particles.positions[i] = glm::vec3(
             r * std::sin(phi) * std::cos(theta),
             r * std::sin(phi) * std::sin(theta),
             r * std::cos(phi)
         );
 
-        p.velocity = glm::vec3(
+        particles.velocities[i] = glm::vec3(
             // (1.0f - 2.0f * dist(gen)) * 0.5,
             // (1.0f - 2.0f * dist(gen)) * 0.5,
             // (1.0f - 2.0f * dist(gen)) * 0.5
             0, 0, 0
         );
 
-        p.color = glm::vec4(
+        particles.colors[i] = glm::vec4(
             62.0f / 255,
             164.0f / 255,
             240.0f / 255,
@@ -39,24 +65,34 @@ void SPH::initialize_particles_sphere(int count, glm::vec3 center, float radius)
     }
 }
 
-void SPH::initialize_particles_cube(glm::vec3 center, float side_length, float spacing) {
+template <typename Kernel, typename Search>
+size_t SPH<Kernel, Search>::cube_particle_count(float side_length, float spacing) {
+    const size_t particles_per_axis = static_cast<int>(side_length / spacing);
+    return particles_per_axis * particles_per_axis * particles_per_axis;
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::initialize_particles_cube(glm::vec3 center, float side_length, float spacing) {
     int particles_per_axis = static_cast<int>(side_length / spacing);
     glm::vec3 start = center - glm::vec3(side_length) * 0.5f;
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> dist(0.5f, 1.0f);
 
-    particles = std::vector<Particle>(particles_per_axis * particles_per_axis * particles_per_axis);
+    particles.resize(cube_particle_count(side_length, spacing), pool);
+    set_neighbor_mode(neighbor_mode);
+    forces_valid = false;
+    wake_all();
 
     for (int x = 0; x < particles_per_axis; ++x) {
         for (int y = 0; y < particles_per_axis; ++y) {
             for (int z = 0; z < particles_per_axis; ++z) {
-                Particle& p = particles[x * particles_per_axis * particles_per_axis + y * particles_per_axis + z];
-                p.position = start + glm::vec3(x, y, z) * spacing;
+                int i = x * particles_per_axis * particles_per_axis + y * particles_per_axis + z;
+                particles.positions[i] = start + glm::vec3(x, y, z) * spacing;
 
-                // p.velocity = glm::vec3(0.0f);  // initial rest
-                p.velocity = glm::vec3(0.01 * dist(gen), -1.0 + 0.01 * dist(gen), 0.01 * dist(gen));
-                p.color = glm::vec4(
+                // particles.velocities[i] = glm::vec3(0.0f);  // initial rest
+                particles.velocities[i] = glm::vec3(0.01 * dist(gen), -1.0 + 0.01 * dist(gen), 0.01 * dist(gen));
+                particles.colors[i] = glm::vec4(
                     62.0f / 255.0f,
                     164.0f / 255.0f,
                     240.0f / 255.0f,
@@ -67,196 +103,903 @@ void SPH::initialize_particles_cube(glm::vec3 center, float side_length, float s
     }
 }
 
-void SPH::update_hash(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end) {
-    for(auto i = begin; i != end; i++) {
-        auto& p = *i;
-        p.hash_value = sp_hash.computeHash(sp_hash.positionToCell(p.position));
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::update_hash(size_t begin, size_t end) {
+    for(size_t i = begin; i < end; i++) {
+        particles.hash_values[i] = sp_hash.computeHash(sp_hash.positionToCell(particles.positions[i]));
     }
 }
 
-float SPH::poly6(glm::vec3 r_v, float h) {
-    float r = glm::length(r_v);
-    if(r <= h) {
-        return poly6_const * pow((pow(h, 2) - pow(r, 2)), 3);
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::update_properties(size_t begin, size_t end) {
+    if(neighbor_mode == NeighborMode::lists && simd_isa != sph_simd::Isa::scalar) {
+        const glm::vec3* pos = particles.positions.data();
+        const uint32_t* idx = neighbors.indices.data();
+
+        for(size_t i = begin; i < end; i++) {
+            const float density = simd_density(kernel_params, pos, pos[i], idx + neighbors.begin(i),
+                                               neighbors.end(i) - neighbors.begin(i));
+            particles.densities[i] = density;
+            particles.pressures[i] = k * (density - rho0);
+        }
+        return;
     }
 
-    return 0;
+    for(size_t i = begin; i < end; i++) {
+        float density = 0.0f;
+        for_each_neighbor(i, [&](uint32_t j, const glm::vec3&, float r) {
+            density += mass_of(j) * Kernel::W(pair_kernel(i, j), r);
+        });
+
+        particles.densities[i] = density;
+        particles.pressures[i] = k * (density - rho0);
+    }
 }
 
-glm::vec3 SPH::spiky_grad(glm::vec3 r_v, float h) {
-    float r = glm::length(r_v);
-    if(0 < r && r <= h) {
-        return ((float) (spikyGrad_const * pow((h - r), 2) / r)) * r_v;
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::calculate_forces(size_t begin, size_t end) {
+    const glm::vec3* vel = particles.velocities.data();
+    const float* rho = particles.densities.data();
+    const float* prs = particles.pressures.data();
+
+    if(neighbor_mode == NeighborMode::lists && simd_isa != sph_simd::Isa::scalar) {
+        const glm::vec3* pos = particles.positions.data();
+        const uint32_t* idx = neighbors.indices.data();
+
+        for(size_t i = begin; i < end; i++) {
+            if(rho[i] == 0) { continue; }
+
+            const sph_simd::ForceSums f = simd_force(kernel_params, pos, vel, rho, prs, i, idx + neighbors.begin(i),
+                                                     neighbors.end(i) - neighbors.begin(i));
+            particles.accelerations[i] = gravity + f.pressure / rho[i] + f.viscosity / rho[i];
+        }
+        return;
     }
 
-    return glm::vec3(0);
+    for(size_t i = begin; i < end; i++) {
+        if(rho[i] == 0) { continue; }
+
+        glm::vec3 pressure_force(0.0, 0.0, 0.0);
+        glm::vec3 viscosity_force(0.0, 0.0, 0.0);
+
+        for_each_neighbor(i, [&](uint32_t j, const glm::vec3& r_v, float r) {
+            if(rho[j] == 0.0 || r == 0.0f) { return; }
+
+            const KernelCoeffs& c = pair_kernel(i, j);
+            const float m = mass_of(j);
+            pressure_force -= m * ((prs[i] + prs[j]) / (2 * rho[j])) * Kernel::grad(c, r) * r_v;
+            viscosity_force += mu * m * (vel[j] - vel[i]) / rho[j] * Kernel::laplacian(c, r);
+
+        });
+
+        glm::vec3 acceleration = gravity;
+        acceleration += pressure_force / rho[i]  ;
+        acceleration += viscosity_force / rho[i] ;
+        particles.accelerations[i] = acceleration;
+    }
 }
 
-float SPH::viscosity_laplace(glm::vec3 r_v, float h) {
-    float r = glm::length(r_v);
-    if(0 < r && r <= h) {
-        return ((float) viscosityLaplace_const * (h - r));
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::update_state(size_t begin, size_t end, float dt) {
+    for(size_t i = begin; i < end; i++) {
+        particles.velocities[i] += particles.accelerations[i] * dt;
+        particles.positions[i] += particles.velocities[i] * dt;
     }
+}
 
-    return 0.0f;
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::kick(size_t begin, size_t end, float dt) {
+    for(size_t i = begin; i < end; i++) {
+        particles.velocities[i] += particles.accelerations[i] * dt;
+    }
 }
 
-void SPH::update_properties(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end) {
-    for(auto i = begin; i != end; i++) {
-        auto& pi = *i;
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::drift(size_t begin, size_t end, float dt) {
+    for(size_t i = begin; i < end; i++) {
+        particles.positions[i] += particles.velocities[i] * dt;
+    }
+}
 
-        pi.density = 0.0f;
-        for(auto& pj: pi.neighbors){ 
-            pi.density += mass * poly6(pi.position - pj->position, h);
-        }
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::compute_forces() {
+    update_neighbor_search();
 
-        pi.pressure = k * (pi.density - rho0);
+    if(use_pairs()) {
+        pair_densities();
+        pair_forces();
+        return;
     }
+
+    parallel_awake(&SPH::update_properties);
+    parallel_awake(&SPH::calculate_forces);
 }
 
-void SPH::calculate_forces(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end) {
-    for(auto i = begin; i != end; i++) {
-        auto& pi = *i;
-        if(pi.density == 0) { continue; }
+// PBF passes need every particle's full neighborhood, pairs are a WCSPH-only path
+template <typename Kernel, typename Search>
+bool SPH<Kernel, Search>::use_pairs() const {
+    return symmetric_pairs && solver == Solver::wcsph;
+}
 
-        glm::vec3 pressure_force(0.0, 0.0, 0.0);
-        glm::vec3 viscosity_force(0.0, 0.0, 0.0);
+// Sums every chunk's buffer entry for each particle into reduce(i, sum) and clears it again
+template <typename Kernel, typename Search>
+template <typename Buffer, typename Reduce>
+void SPH<Kernel, Search>::reduce_pairs(std::vector<Buffer>& buffers, Reduce&& reduce) {
+    pool.parallel_for(particles.size(), [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            typename Buffer::value_type sum {};
+            for(size_t c = 0; c < buffers.size(); c++) {
+                if(i < pair_begin[c] || i >= pair_end[c]) { continue; }
+                sum += buffers[c][i];
+                buffers[c][i] = {};
+            }
+            reduce(i, sum);
+        }
+    });
+}
+
+// Morton order keeps j close to i, so each chunk only writes a little past its own range
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pair_densities() {
+    const size_t n = particles.size();
+
+    pair_density.resize(pool.size());
+    pair_begin.assign(pool.size(), 0);
+    pair_end.assign(pool.size(), 0);
+
+    pool.parallel_for(awake_count(), [&](size_t begin, size_t end, size_t chunk) {
+        auto& rho = pair_density[chunk];
+        rho.resize(n, 0.0f);
+        uint32_t first = awake_index(begin);
+        uint32_t last = awake_index(end - 1) + 1;
+
+        for(size_t a = begin; a < end; a++) {
+            const size_t i = awake_index(a);
+            const float m_i = mass_of(i);
+            float density = m_i * Kernel::W(pair_kernel(i, i), 0.0f);
+            for_each_pair(i, [&](uint32_t j, const glm::vec3&, float r) {
+                const KernelCoeffs& c = pair_kernel(i, j);
+                if(r >= c.h) { return; }
+
+                const float w = Kernel::W(c, r);
+                density += mass_of(j) * w;
+                rho[j] += m_i * w;
+                first = std::min(first, j);
+                last = std::max(last, j + 1);
+            });
+            rho[i] += density;
+        }
 
-        for(auto& pj: pi.neighbors){ 
-            if(pj->density == 0.0) { continue; }
+        pair_begin[chunk] = first;
+        pair_end[chunk] = last;
+    });
 
-            pressure_force -= mass * ((pi.pressure + pj->pressure) / (2 * pj->density)) * spiky_grad(pi.position - pj->position, h);
-            viscosity_force += mu * mass * (pj->velocity - pi.velocity) / pj->density * viscosity_laplace(pi.position - pj->position, h);
+    // Sleepers keep the density they fell asleep with
+    reduce_pairs(pair_density, [this](size_t i, float density) {
+        if(asleep(i)) { return; }
+        particles.densities[i] = density;
+        particles.pressures[i] = k * (density - rho0);
+    });
+}
 
+// The pair term t = (p_i + p_j) / 2 grad W_ij - mu L_ij (v_j - v_i) goes to i as -m_j t / rho_j
+// and to j as +m_i t / rho_i, the same forces calculate_forces() gets from both sides
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pair_forces() {
+    const size_t n = particles.size();
+    const glm::vec3* vel = particles.velocities.data();
+    const float* rho = particles.densities.data();
+    const float* prs = particles.pressures.data();
+
+    pair_force.resize(pool.size());
+    pair_begin.assign(pool.size(), 0);
+    pair_end.assign(pool.size(), 0);
+
+    pool.parallel_for(awake_count(), [&](size_t begin, size_t end, size_t chunk) {
+        auto& force = pair_force[chunk];
+        force.resize(n, glm::vec3(0.0f));
+        uint32_t first = awake_index(begin);
+        uint32_t last = awake_index(end - 1) + 1;
+
+        for(size_t a = begin; a < end; a++) {
+            const size_t i = awake_index(a);
+            const float m_i = mass_of(i);
+            glm::vec3 force_i(0.0f);
+
+            for_each_pair(i, [&](uint32_t j, const glm::vec3& r_v, float r) {
+                const KernelCoeffs& c = pair_kernel(i, j);
+                if(r == 0.0f || r >= c.h) { return; }
+
+                const glm::vec3 t = (prs[i] + prs[j]) * 0.5f * Kernel::grad(c, r) * r_v -
+                                    mu * Kernel::laplacian(c, r) * (vel[j] - vel[i]);
+                if(rho[j] != 0.0f) { force_i -= mass_of(j) * t / rho[j]; }
+                if(rho[i] != 0.0f) { force[j] += m_i * t / rho[i]; }
+                first = std::min(first, j);
+                last = std::max(last, j + 1);
+            });
+
+            force[i] += force_i;
         }
 
-        pi.acceleration = gravity;
-        pi.acceleration += pressure_force / pi.density  ;
-        pi.acceleration += viscosity_force / pi.density ;
+        pair_begin[chunk] = first;
+        pair_end[chunk] = last;
+    });
+
+    reduce_pairs(pair_force, [this, rho](size_t i, const glm::vec3& f) {
+        if(rho[i] == 0 || asleep(i)) { return; }
+        particles.accelerations[i] = gravity + f / rho[i];
+    });
+}
+
+// CFL, force and viscous diffusion limits for the next substep
+template <typename Kernel, typename Search>
+float SPH<Kernel, Search>::time_step_limit() {
+    if(!adaptive_time_step) { return delta_time; }
+
+    const glm::vec3* vel = particles.velocities.data();
+    const glm::vec3* acc = particles.accelerations.data();
+    const float v_max = std::sqrt(parallel_max([vel](size_t i) { return glm::dot(vel[i], vel[i]); }));
+
+    // Incompressibility is a position constraint in PBF, only the particle motion limits the step
+    if(solver == Solver::pbf) {
+        const float dt = v_max > 0 ? sph_c::cfl_factor * h / v_max : sph_c::max_time_step;
+        return std::clamp(dt, sph_c::min_time_step, sph_c::max_time_step);
     }
+
+    const float a_max = std::sqrt(parallel_max([acc](size_t i) { return glm::dot(acc[i], acc[i]); }));
+
+    // Pressure is k (rho - rho0), so the speed of sound is sqrt(k)
+    const float c = std::sqrt(k);
+
+    float dt = sph_c::cfl_factor * h / (c + v_max);
+    if(a_max > 0) { dt = std::min(dt, sph_c::force_factor * std::sqrt(h / a_max)); }
+    if(mu > 0) { dt = std::min(dt, sph_c::viscosity_factor * h * h * rho0 / mu); }
+
+    return std::clamp(dt, sph_c::min_time_step, sph_c::max_time_step);
 }
 
-void SPH::update_state(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end) {
-    for(auto i = begin; i != end; i++) {
-        auto& p = *i;
+// Advances the simulation to the end of the next output frame, frames_advanced * delta_time, in
+// substeps of time_step_limit(). Substeps run over frame ends instead of being cut short to meet
+// them, so time may end up to one substep past the frame end, and a frame an earlier long substep
+// already covered takes none. Returns the number of substeps taken.
+template <typename Kernel, typename Search>
+int SPH<Kernel, Search>::advance_frame() {
+    const double frame_end = static_cast<double>(++frames_advanced) * delta_time;
+    int substeps = 0;
+
+    // Set by any substep's reorder, the renderer re-uploads the colors once per frame
+    reordered = false;
+
+    // Fixed steps of delta_time land on the frame end up to round-off
+    while(time < frame_end - 1e-4 * delta_time) {
+        if(solver == Solver::pbf) {
+            const float dt = time_step_limit();
+            pbf_step(dt);
+
+            time += dt;
+            last_dt = dt;
+            substeps++;
+            continue;
+        }
+
+        if(integrator == Integrator::symplectic_euler || !forces_valid) { compute_forces(); }
+
+        const float dt = time_step_limit();
+
+        if(integrator == Integrator::leapfrog) {
+            parallel_awake(&SPH::kick, 0.5f * dt);
+            parallel_awake(&SPH::drift, dt);
+            parallel_awake(&SPH::boundary_conditions);
+            compute_forces();
+            parallel_awake(&SPH::kick, 0.5f * dt);
+            forces_valid = true;
+        } else {
+            parallel_awake(&SPH::update_state, dt);
+            parallel_awake(&SPH::boundary_conditions);
+        }
 
-        p.velocity += p.acceleration * delta_time;
-        p.position += p.velocity * delta_time;
+        if(sleep_steps > 0) { update_sleep(); }
+
+        time += dt;
+        last_dt = dt;
+        substeps++;
+    }
+
+    if(adaptive_levels > 0 && solver == Solver::wcsph && halo_count == 0 && ++frames_since_adapt >= sph_c::adapt_interval) {
+        adapt_resolution();
+        frames_since_adapt = 0;
     }
+
+    last_substeps = substeps;
+    return substeps;
 }
 
-void SPH::update_neighbors(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end) {
-    for(auto i = begin; i != end; i++) {
-        auto& p = *i;
+// One PBF substep: predict positions under gravity, project the density constraints
+// pbf_iterations times with neighbors found at the predicted positions, then derive
+// velocities from the displacement and smooth them with XSPH
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pbf_step(float dt) {
+    const size_t n = particles.size();
+    pbf_prev_positions.resize(n);
+    pbf_lambdas.resize(n);
+    pbf_corrections.resize(n);
+
+    pool.parallel_for(n, [this](size_t begin, size_t end) {
+        std::copy(particles.positions.begin() + begin, particles.positions.begin() + end, pbf_prev_positions.begin() + begin);
+    });
+
+    parallel(&SPH::pbf_predict, dt);
+    parallel(&SPH::boundary_conditions);
+    update_neighbor_search();
+
+    if(pbf_rho0 <= 0) {
+        parallel(&SPH::update_properties);
+        pbf_rho0 = parallel_max([this](size_t i) { return particles.densities[i]; });
+    }
 
-        p.neighbors.clear();
-        sp_hash.queryNeighbors(p.position, p.neighbors);
+    for(int iter = 0; iter < sph_c::pbf_iterations; iter++) {
+        parallel(&SPH::pbf_lambda);
+        parallel(&SPH::pbf_position_correction);
+        parallel(&SPH::apply_corrections, &particles.positions);
+        parallel(&SPH::boundary_conditions);
     }
+
+    parallel(&SPH::pbf_update_velocity, dt);
+    parallel(&SPH::pbf_xsph_viscosity);
+    parallel(&SPH::apply_corrections, &particles.velocities);
 }
 
-void SPH::boundary_conditions(std::vector<Particle>::iterator begin, std::vector<Particle>::iterator end) {
-    // float flim_x = lim_x - sprite_size / 2;
-    // float flim_y = lim_y - sprite_size / 2;
-    // float flim_z = lim_z - sprite_size / 2;
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pbf_predict(size_t begin, size_t end, float dt) {
+    for(size_t i = begin; i < end; i++) {
+        particles.velocities[i] += gravity * dt;
+        particles.positions[i] += particles.velocities[i] * dt;
+    }
+}
 
-    float flim_x = lim_x - sprite_size;
-    float flim_y = lim_y - sprite_size;
-    float flim_z = lim_z - sprite_size;
+// lambda_i = -C_i / (sum_k |grad_k C_i|^2 + relaxation) with C_i = max(rho_i / rho0 - 1, 0),
+// the clamp keeps the free surface from pulling particles together
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pbf_lambda(size_t begin, size_t end) {
+    const float scale = mass / pbf_rho0;
+
+    for(size_t i = begin; i < end; i++) {
+        float density = 0.0f;
+        float grad_sum2 = 0.0f;
+        glm::vec3 grad_i(0.0f);
+
+        for_each_neighbor(i, [&](uint32_t, const glm::vec3& r_v, float r) {
+            density += mass * Kernel::W(kernel, r);
+            if(r == 0.0f) { return; }
+
+            const glm::vec3 grad_j = scale * Kernel::grad(kernel, r) * r_v;
+            grad_i += grad_j;
+            grad_sum2 += glm::dot(grad_j, grad_j);
+        });
+
+        const float constraint = std::max(density / pbf_rho0 - 1.0f, 0.0f);
+        particles.densities[i] = density;
+        pbf_lambdas[i] = -constraint / (grad_sum2 + glm::dot(grad_i, grad_i) + sph_c::pbf_relaxation);
+    }
+}
 
-    for(auto i = begin; i != end; i++) {
-        auto& p = *i;
-        if(p.position.x < -flim_x) {
-            p.position.x = -flim_x;
-            p.velocity.x = -p.velocity.x * damping_factor;
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pbf_position_correction(size_t begin, size_t end) {
+    const float scale = mass / pbf_rho0;
+    const float w_dq = Kernel::W(kernel, sph_c::pbf_tensile_dq * h);
+
+    for(size_t i = begin; i < end; i++) {
+        glm::vec3 delta(0.0f);
+
+        for_each_neighbor(i, [&](uint32_t j, const glm::vec3& r_v, float r) {
+            if(r == 0.0f) { return; }
+
+            const float w = Kernel::W(kernel, r) / w_dq;
+            const float s_corr = -sph_c::pbf_tensile_k * (w * w) * (w * w);
+            delta += (pbf_lambdas[i] + pbf_lambdas[j] + s_corr) * Kernel::grad(kernel, r) * r_v;
+        });
+
+        pbf_corrections[i] = scale * delta;
+    }
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pbf_update_velocity(size_t begin, size_t end, float dt) {
+    for(size_t i = begin; i < end; i++) {
+        particles.velocities[i] = (particles.positions[i] - pbf_prev_positions[i]) / dt;
+    }
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::pbf_xsph_viscosity(size_t begin, size_t end) {
+    const glm::vec3* vel = particles.velocities.data();
+    const float* rho = particles.densities.data();
+
+    for(size_t i = begin; i < end; i++) {
+        glm::vec3 dv(0.0f);
+
+        for_each_neighbor(i, [&](uint32_t j, const glm::vec3&, float r) {
+            if(rho[j] == 0.0f) { return; }
+            dv += (mass / rho[j]) * (vel[j] - vel[i]) * Kernel::W(kernel, r);
+        });
+
+        pbf_corrections[i] = sph_c::pbf_xsph * dv;
+    }
+}
+
+// Adds pbf_corrections to positions or velocities, kept as a separate pass so every
+// correction is computed from the same state
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::apply_corrections(size_t begin, size_t end, aligned_vector<glm::vec3>* target) {
+    for(size_t i = begin; i < end; i++) {
+        (*target)[i] += pbf_corrections[i];
+    }
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::update_neighbors() {
+    const glm::vec3* pos = particles.positions.data();
+    neighbors.build(particles.size(), [pos](size_t i) { return pos[i]; }, pos, sp_hash, h + neighbor_skin, pool,
+                    RowFilter {this, use_pairs()});
+}
+
+// Runs after every WCSPH substep: counts still substeps, wakes disturbed sleepers and
+// rebuilds the awake list
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::update_sleep() {
+    parallel_awake(&SPH::update_activity);
+    wake_disturbed();
+    collect_awake();
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::update_activity(size_t begin, size_t end) {
+    const float v2 = sph_c::sleep_velocity * sph_c::sleep_velocity;
+
+    for(size_t i = begin; i < end; i++) {
+        const glm::vec3& v = particles.velocities[i];
+        const float density = particles.densities[i];
+        const bool still = glm::dot(v, v) < v2 &&
+                           std::abs(density - sleep_densities[i]) < sph_c::sleep_density_change * density;
+        sleep_densities[i] = density;
+
+        quiet_steps[i] = still ? std::min<int>(quiet_steps[i] + 1, sleep_steps) : 0;
+        if(quiet_steps[i] >= sleep_steps) {
+            particles.velocities[i] = glm::vec3(0.0f);
+            particles.accelerations[i] = glm::vec3(0.0f);
         }
+    }
+}
 
-        if(p.position.x > flim_x) {
-            p.position.x = flim_x;
-            p.velocity.x = -p.velocity.x * damping_factor;
+// Flags the 27 buckets (more for coarse particles) around every awake particle faster than
+// wake_velocity and wakes the sleepers in them. Sleepers do not move, so their hash_values from the last build still hold.
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::wake_disturbed() {
+    const size_t n = particles.size();
+    const float v2 = sph_c::wake_velocity * sph_c::wake_velocity;
+    disturbed.resize(sp_hash.bucketCount(), 0);
+    disturbed_buckets.clear();
+
+    for(size_t a = 0; a < awake_count(); a++) {
+        const size_t i = awake_index(a);
+        const glm::vec3& v = particles.velocities[i];
+        if(glm::dot(v, v) <= v2) { continue; }
+
+        const glm::ivec3 cell = sp_hash.positionToCell(particles.positions[i]);
+        const int reach = search_reach(i);
+        for(int dx = -reach; dx <= reach; dx++) {
+            for(int dy = -reach; dy <= reach; dy++) {
+                for(int dz = -reach; dz <= reach; dz++) {
+                    const uint32_t bucket = sp_hash.computeHash(cell + glm::ivec3(dx, dy, dz));
+                    if(disturbed[bucket]) { continue; }
+                    disturbed[bucket] = 1;
+                    disturbed_buckets.push_back(bucket);
+                }
+            }
         }
+    }
+
+    if(disturbed_buckets.empty()) { return; }
+
+    pool.parallel_for(n, [this](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            if(quiet_steps[i] >= sleep_steps && disturbed[particles.hash_values[i]]) { quiet_steps[i] = 0; }
+        }
+    });
+
+    for(uint32_t bucket : disturbed_buckets) { disturbed[bucket] = 0; }
+}
+
+// Compacts the awake indices in order: per-chunk counts, then each chunk fills its slice
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::collect_awake() {
+    const size_t n = particles.size();
+    awake_counts.assign(pool.size() + 1, 0);
+
+    pool.parallel_for(n, [this](size_t begin, size_t end, size_t chunk) {
+        uint32_t count = 0;
+        for(size_t i = begin; i < end; i++) { count += quiet_steps[i] < sleep_steps; }
+        awake_counts[chunk + 1] = count;
+    });
+
+    for(int c = 0; c < pool.size(); c++) { awake_counts[c + 1] += awake_counts[c]; }
+    awake_next.resize(awake_counts.back());
+
+    pool.parallel_for(n, [this](size_t begin, size_t end, size_t chunk) {
+        uint32_t slot = awake_counts[chunk];
+        for(size_t i = begin; i < end; i++) {
+            if(quiet_steps[i] < sleep_steps) { awake_next[slot++] = i; }
+        }
+    });
+
+    // Sleepers have no rows of their own, so a skin-cached table is stale once the set changes
+    if(neighbor_skin > 0 && !std::equal(awake.begin(), awake.end(), awake_next.begin(), awake_next.end())) {
+        skin_positions.clear();
+    }
+
+    awake.swap(awake_next);
+    sleeping = n - awake.size();
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::wake_all() {
+    quiet_steps.resize(particles.size());
+    sleep_densities.resize(particles.size());
+    pool.parallel_for(particles.size(), [this](size_t begin, size_t end) {
+        std::fill(quiet_steps.begin() + begin, quiet_steps.begin() + end, 0);
+        std::fill(sleep_densities.begin() + begin, sleep_densities.begin() + end, 0.0f);
+    });
+
+    awake.clear();
+    sleeping = 0;
+}
+
+// Called after particles were added or removed from outside: sleep state and any
+// skin-cached neighbor table no longer match the arrays
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::particles_changed() {
+    wake_all();
+    skin_positions.clear();
+    forces_valid = false;
+}
+
+// Merges pairs of nearby interior particles of the same level into one of the next level, and
+// splits merged particles on the free surface into two of the level below. Mass, momentum and
+// the centre of mass are kept, children get fresh ids. Merges are paired greedily in index order,
+// serially so no particle is claimed twice. Runs on the search built at the last substep and
+// rebuilds it for the new arrays. Returns the change in particle count.
+template <typename Kernel, typename Search>
+int SPH<Kernel, Search>::adapt_resolution() {
+    ParticleStore& p = particles;
+    const size_t n = p.size();
+    surface.resize(n);
+    near_surface.resize(n);
+    parallel(&SPH::flag_surface);
+    parallel(&SPH::flag_near_surface);
+
+    // 1 for merged away, 2 for changed in this pass (never paired again)
+    removed.assign(n, 0);
+    split_parents.clear();
+    bool changed = false;
+
+    for(size_t i = 0; i < n; i++) {
+        if(removed[i] || near_surface[i] || p.levels[i] >= adaptive_levels) { continue; }
+
+        const glm::vec3 x = p.positions[i];
+        const float h_i = pair_kernel(i, i).h;
+        float closest = h_i * h_i;
+        int64_t partner = -1;
+
+        sp_hash.forEachNeighbor(x, [&](uint32_t j) {
+            if(j == i || removed[j] || near_surface[j] || p.levels[j] != p.levels[i]) { return; }
+            const glm::vec3 d = p.positions[j] - x;
+            const float r2 = glm::dot(d, d);
+            if(r2 < closest) {
+                closest = r2;
+                partner = j;
+            }
+        }, search_reach(i));
+        if(partner < 0) { continue; }
+
+        // Equal masses, so the merged particle takes the plain averages
+        const size_t j = partner;
+        p.positions[i] = 0.5f * (p.positions[i] + p.positions[j]);
+        p.velocities[i] = 0.5f * (p.velocities[i] + p.velocities[j]);
+        p.accelerations[i] = 0.5f * (p.accelerations[i] + p.accelerations[j]);
+        p.densities[i] = 0.5f * (p.densities[i] + p.densities[j]);
+        p.pressures[i] = 0.5f * (p.pressures[i] + p.pressures[j]);
+        p.levels[i]++;
+        quiet_steps[i] = 0;
+        removed[i] = 2;
+        removed[j] = 1;
+        changed = true;
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        if(!removed[i] && surface[i] && p.levels[i] > 0) { split_parents.push_back(i); }
+    }
+
+    // Each child is set a quarter of its smoothing length from the parent, in a direction
+    // hashed from the parent's id
+    if(!split_parents.empty()) {
+        const size_t base = p.size();
+        const size_t count = split_parents.size();
+        uint32_t next_id = *std::max_element(p.ids.begin(), p.ids.end()) + 1;
+
+        p.for_each_array([base, count](auto& a) { a.resize(base + count); });
+        quiet_steps.resize(base + count);
+        sleep_densities.resize(base + count);
+        removed.resize(base + count, 0);
+
+        for(size_t k = 0; k < count; k++) {
+            const size_t i = split_parents[k];
+            const size_t c = base + k;
+            p.for_each_array([i, c](auto& a) { a[c] = a[i]; });
+            p.levels[i]--;
+            p.levels[c] = p.levels[i];
+            p.ids[c] = next_id++;
+
+            const uint32_t s = p.ids[i] * 2654435761u;
+            const glm::vec3 dir = glm::normalize(glm::vec3((s & 1023) + 0.5f, ((s >> 10) & 1023) + 0.5f, ((s >> 20) & 1023) + 0.5f) - 512.0f);
+            const glm::vec3 offset = 0.25f * pair_kernel(i, i).h * dir;
+            p.positions[i] += offset;
+            p.positions[c] -= offset;
+
+            quiet_steps[i] = quiet_steps[c] = 0;
+            sleep_densities[c] = sleep_densities[i];
+        }
+        changed = true;
+    }
+
+    if(!changed) { return 0; }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < p.size(); i++) {
+        if(removed[i] == 1) { continue; }
+        if(i != kept) {
+            const auto move = [i, kept](auto& a) { a[kept] = a[i]; };
+            p.for_each_array(move);
+            move(quiet_steps);
+            move(sleep_densities);
+        }
+        kept++;
+    }
+
+    p.for_each_array([kept](auto& a) { a.resize(kept); });
+    quiet_steps.resize(kept);
+    sleep_densities.resize(kept);
+    if(sleeping > 0) { collect_awake(); }
+
+    skin_positions.clear();
+    forces_valid = false;
+    reordered = true;
+    parallel(&SPH::update_hash);
+    sp_hash.build(p, pool);
+
+    return static_cast<int>(kept) - static_cast<int>(n);
+}
+
+// Free surface particles see their kernel-weighted neighbor centroid shifted into the fluid.
+// A wall shifts it along the wall normal as well, so that part is left out next to colliders.
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::flag_surface(size_t begin, size_t end) {
+    const glm::vec3* pos = particles.positions.data();
+
+    for(size_t i = begin; i < end; i++) {
+        const float h_i = pair_kernel(i, i).h;
+        glm::vec3 centroid(0.0f);
+        float weight = 0.0f;
+
+        sp_hash.forEachNeighbor(pos[i], [&](uint32_t j) {
+            const glm::vec3 d = pos[j] - pos[i];
+            const float w = mass_of(j) * Kernel::W(pair_kernel(i, j), glm::length(d));
+            centroid += w * d;
+            weight += w;
+        }, search_reach(i));
+
+        glm::vec3 offset = centroid / weight;
+
+        glm::vec3 normal;
+        const float phi = collider.sample(pos[i], &normal);
+        const float length = glm::length(normal);
+        if(phi < h_i && length > 0.0f) {
+            normal /= length;
+            offset -= std::max(glm::dot(offset, normal), 0.0f) * normal;
+        }
+
+        surface[i] = glm::length(offset) > sph_c::surface_offset * h_i;
+    }
+}
 
-        // if(p.position.y > flim_y) {
-        //     p.position.y = flim_y;
-        //     p.velocity.y = -p.velocity.y * damping_factor;
-        // }
+// Marks the particles with a surface particle within their pair support
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::flag_near_surface(size_t begin, size_t end) {
+    const glm::vec3* pos = particles.positions.data();
+
+    for(size_t i = begin; i < end; i++) {
+        uint8_t near = surface[i];
+        sp_hash.forEachNeighbor(pos[i], [&](uint32_t j) {
+            if(near || !surface[j]) { return; }
+            const float support_ij = pair_kernel(i, j).h;
+            const glm::vec3 d = pos[j] - pos[i];
+            near = glm::dot(d, d) < support_ij * support_ij;
+        }, search_reach(i));
+        near_surface[i] = near;
+    }
+}
 
-        if(p.position.y < -flim_y) {
-            p.position.y = -flim_y;
-            p.velocity.y = -p.velocity.y * damping_factor;
+// Counts the neighbor reads where j belongs to a thread on another node than i. The density
+// pass reads 12 bytes of j (position), the force pass 32 (position, velocity, density, pressure).
+// Only meaningful with a numa_aware pool, where particle ranges stay on their node.
+template <typename Kernel, typename Search>
+NumaTraffic SPH<Kernel, Search>::numa_traffic() {
+    const size_t n = particles.size();
+    std::vector<NumaTraffic> chunk_traffic(pool.size(), NumaTraffic {0, 0, 0});
+
+    pool.parallel_for(n, [&](size_t begin, size_t end, size_t chunk) {
+        NumaTraffic& t = chunk_traffic[chunk];
+        for(size_t i = begin; i < end; i++) {
+            const int node = pool.node_of(i, n);
+            for_each_neighbor(i, [&](uint32_t j, const glm::vec3&, float) {
+                t.reads++;
+                if(pool.node_of(j, n) != node) { t.remote_reads++; }
+            });
         }
+        t.remote_bytes = t.remote_reads * (12 + 32);
+    });
+
+    NumaTraffic total {0, 0, 0};
+    for(const NumaTraffic& t : chunk_traffic) {
+        total.reads += t.reads;
+        total.remote_reads += t.remote_reads;
+        total.remote_bytes += t.remote_bytes;
+    }
+    return total;
+}
 
-        if(p.position.z < -flim_z) {
-            p.position.z = -flim_z;
-            p.velocity.z = -p.velocity.z * damping_factor;
+template <typename Kernel, typename Search>
+float SPH<Kernel, Search>::max_displacement() {
+    const glm::vec3* pos = particles.positions.data();
+    const glm::vec3* skin = skin_positions.data();
+
+    return std::sqrt(parallel_max([pos, skin](size_t i) {
+        const glm::vec3 d = pos[i] - skin[i];
+        return glm::dot(d, d);
+    }));
+}
+
+// Sorts the particles along a Z-order curve over the hash cells
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::reorder_particles() {
+    const size_t n = particles.size();
+    morton_keys.resize(n);
+    morton_order.resize(n);
+
+    pool.parallel_for(n, [this](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            const uint64_t code = morton_code(sp_hash.positionToCell(particles.positions[i]));
+            morton_keys[i] = (code << 32) | i;
         }
+    });
 
-        if(p.position.z > flim_z) {
-            p.position.z = flim_z;
-            p.velocity.z = -p.velocity.z * damping_factor;
+    std::sort(morton_keys.begin(), morton_keys.end());
+    for(size_t i = 0; i < n; i++) { morton_order[i] = static_cast<uint32_t>(morton_keys[i]); }
+
+    // The PBF start positions are live across the neighbor search that may reorder
+    if(pbf_prev_positions.size() == n) {
+        particles.permute(morton_order, permute_visited, quiet_steps, sleep_densities, pbf_prev_positions);
+    } else {
+        particles.permute(morton_order, permute_visited, quiet_steps, sleep_densities);
+    }
+
+    if(sleeping > 0) { collect_awake(); }
+}
+
+// Rebuilds the hash (and the neighbor table in lists mode) unless every particle is still
+// within half the skin of where it was at the last build. Returns true if it rebuilt.
+template <typename Kernel, typename Search>
+bool SPH<Kernel, Search>::update_neighbor_search() {
+    steps_since_reorder++;
+
+    if(neighbor_skin > 0 && skin_positions.size() == particles.size() &&
+       max_displacement() <= 0.5f * neighbor_skin) {
+        return false;
+    }
+
+    if(reorder_interval > 0 && steps_since_reorder >= reorder_interval && halo_count == 0) {
+        reorder_particles();
+        steps_since_reorder = 0;
+        reordered = true;
+    }
+
+    parallel(&SPH::update_hash);
+    sp_hash.build(particles, pool);
+    if(neighbor_mode == NeighborMode::lists) { update_neighbors(); }
+
+    if(neighbor_skin > 0) {
+        skin_positions.resize(particles.size());
+        pool.parallel_for(particles.size(), [this](size_t begin, size_t end) {
+            std::copy(particles.positions.begin() + begin, particles.positions.begin() + end, skin_positions.begin() + begin);
+        });
+    }
+
+    return true;
+}
+
+// Pushes particles closer than sprite_size to a collider back out along the distance gradient
+// and reflects the velocity component into the collider, damped by damping_factor. In a corner
+// the nearest surface changes after each push, so up to three surfaces are resolved in turn.
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::boundary_conditions(size_t begin, size_t end) {
+    const float margin = sprite_size;
+
+    for(size_t i = begin; i < end; i++) {
+        glm::vec3& position = particles.positions[i];
+        glm::vec3& velocity = particles.velocities[i];
+
+        for(int pass = 0; pass < 3; pass++) {
+            glm::vec3 gradient;
+            const float phi = collider.sample(position, &gradient);
+            if(phi >= margin) { break; }
+
+            const float length = glm::length(gradient);
+            if(length == 0.0f) { break; }
+            const glm::vec3 normal = gradient / length;
+
+            position += (margin - phi) * normal;
+
+            const float vn = glm::dot(velocity, normal);
+            if(vn < 0.0f) { velocity -= (1.0f + damping_factor) * vn * normal; }
         }
     }
 }
 
-void SPH::create_cuboid() {
-    box_positions = {
-        // t1 - Left face
-        glm::vec3(-lim_x, -lim_y,  lim_z),
-        glm::vec3(-lim_x,  lim_y,  lim_z),
-        glm::vec3(-lim_x,  lim_y, -lim_z),
-    
-        // t2 - Left face
-        glm::vec3(-lim_x, -lim_y,  lim_z),
-        glm::vec3(-lim_x, -lim_y, -lim_z),
-        glm::vec3(-lim_x,  lim_y, -lim_z),
-    
-        // t3 - Bottom face
-        glm::vec3(-lim_x, -lim_y,  lim_z),
-        glm::vec3(-lim_x, -lim_y, -lim_z),
-        glm::vec3( lim_x, -lim_y,  lim_z),
-    
-        // t4 - Bottom face
-        glm::vec3(-lim_x, -lim_y, -lim_z),
-        glm::vec3( lim_x, -lim_y,  lim_z),
-        glm::vec3( lim_x, -lim_y, -lim_z),
-    
-        // t5 - Right face
-        glm::vec3( lim_x, -lim_y,  lim_z),
-        glm::vec3( lim_x,  lim_y,  lim_z),
-        glm::vec3( lim_x,  lim_y, -lim_z),
-    
-        // t6 - Right face
-        glm::vec3( lim_x, -lim_y,  lim_z),
-        glm::vec3( lim_x, -lim_y, -lim_z),
-        glm::vec3( lim_x,  lim_y, -lim_z),
-    
-        // t7 - Back face
-        glm::vec3(-lim_x, -lim_y, -lim_z),
-        glm::vec3(-lim_x,  lim_y, -lim_z),
-        glm::vec3( lim_x,  lim_y, -lim_z),
-    
-        // t8 - Back face
-        glm::vec3(-lim_x, -lim_y, -lim_z),
-        glm::vec3( lim_x, -lim_y, -lim_z),
-        glm::vec3( lim_x,  lim_y, -lim_z),
-    
-        // t9 - Top face
-        glm::vec3(-lim_x,  lim_y,  lim_z),
-        glm::vec3(-lim_x,  lim_y, -lim_z),
-        glm::vec3( lim_x,  lim_y,  lim_z),
-    
-        // t10 - Top face
-        glm::vec3(-lim_x,  lim_y, -lim_z),
-        glm::vec3( lim_x,  lim_y,  lim_z),
-        glm::vec3( lim_x,  lim_y, -lim_z),
-
-        // t11 - Front face
-        glm::vec3(-lim_x, -lim_y,  lim_z),
-        glm::vec3(-lim_x,  lim_y,  lim_z),
-        glm::vec3( lim_x,  lim_y,  lim_z),
-
-        // t12 - Front face
-        glm::vec3(-lim_x, -lim_y,  lim_z),
-        glm::vec3( lim_x,  lim_y,  lim_z),
-        glm::vec3( lim_x, -lim_y,  lim_z),
-    };
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::set_neighbor_mode(NeighborMode mode) {
+    neighbor_mode = mode;
+
+    // Stencil mode never touches the table, so give its memory back
+    if(mode == NeighborMode::stencil) {
+        neighbors = NeighborTable {neighbors.store_distances, neighbors.store_deltas};
+    }
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::set_simd_isa(sph_simd::Isa isa) {
+    // The batched kernels assume one mass and smoothing length
+    simd_isa = adaptive_levels > 0 ? sph_simd::Isa::scalar : isa;
+    simd_density = sph_simd::density_kernel(simd_isa);
+    simd_force = sph_simd::force_kernel(simd_isa);
+
+    // PBF moves particles between the passes that use the table, so it always recomputes the geometry
+    const bool scalar = simd_isa == sph_simd::Isa::scalar || use_pairs();
+    const bool cache = sph_c::cache_pair_geometry && neighbor_skin == 0 && scalar && solver == Solver::wcsph;
+    if(cache != neighbors.store_deltas) { neighbors = NeighborTable {cache, cache}; }
+}
+
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::set_solver(Solver s) {
+    solver = s;
+    forces_valid = false;
+    set_simd_isa(simd_isa);
+
+    // Only WCSPH substeps put particles to sleep
+    wake_all();
+
+    // The table switches between half and full lists, rebuild it on the next search
+    skin_positions.clear();
+}
+
+// The container is drawn from the same distance field the particles collide with
+template <typename Kernel, typename Search>
+void SPH<Kernel, Search>::create_container() {
+    box_positions = collider.triangulate();
 }
+
+
+template class SPH<MullerKernel, SpatialHash>;
+template class SPH<CubicSplineKernel, SpatialHash>;
+template class SPH<WendlandC2Kernel, SpatialHash>;
+template class SPH<MullerKernel, NeighborGrid>;
+template class SPH<CubicSplineKernel, NeighborGrid>;
+template class SPH<WendlandC2Kernel, NeighborGrid>;
@@ -43,9 +43,58 @@ namespace main_c {
     const float iso_value = 0.6;
 
     const float sprite_size = l / 8;
+
+    // Worker Threads (0 uses every hardware thread)
+    const int num_threads = 0;
+    const bool pin_threads = false;
+
+    // Worker processes the tank is split into along x in save mode, each gets an equal share
+    // of the threads (1 runs the simulation in this process)
+    const int processes = 1;
+
+    // Spread the pool over the NUMA nodes, pin each thread to its node and keep every particle
+    // range on the same thread, so the first touch at initialisation places it on that node.
+    // Cross-node traffic is estimated every numa_report_interval frames (0 never reports).
+    const bool numa_aware = false;
+    const int numa_report_interval = 100;
+
+    // Back the per-frame scratch arenas with transparent huge pages (Linux only)
+    const bool arena_huge_pages = false;
+
+    // After this many frames a simulation step should not touch the heap, any allocation in it is
+    // reported (negative turns the check off) and fails the step_allocations test. Per-chunk
+    // buffers reach their largest size while the default tank's splash settles, up to frame ~95.
+    const int alloc_warmup_frames = 120;
+
+    // Runs simulate (or replay) frames 0 to max_frames and then exit
+    const int max_frames = 1800;
+
+    // Save mode steps frame N + 1 while a mesh thread marches frame N and a writer thread writes
+    // frame N - 1. pipeline_depth frames are in flight at most (3 keeps every stage busy).
+    // The heap allocation checks only run without the pipeline, the counter is process-wide.
+    const bool save_pipeline = true;
+    const int pipeline_depth = 3;
+
+    // Frame files are written in the compressed version 5 format (frame_codec.h) instead of raw
+    // float arrays (version 6, see frame.h). Either way only the frame_channels bits (FrameChannel,
+    // 0x3f is all of them) are stored. Compressed they are quantized, and positions between
+    // keyframes, which come every keyframe_interval frames, as deltas.
+    const bool frame_compression = true;
+    const uint32_t frame_channels = 0x3f;
+    const int keyframe_interval = 30;
+
+    // Save mode appends every frame to one archive file with a trailing index (frame_archive.h)
+    // instead of writing a file per frame. Load mode replays the archive when there is one.
+    const bool frame_archive = true;
+
+    // Load mode decodes up to prefetch_depth frames ahead on a background thread, and shows them
+    // at playback_speed simulated seconds per second (1 is real time, 0 as fast as they decode)
+    const int prefetch_depth = 8;
+    const float playback_speed = 1.0f;
 }
 
 namespace sph_c {
+    // Simulated time per output frame, and the fixed substep when adaptive_time_step is off
     const float delta_time = 0.016f;
     const float damping_factor = 0.3;
     const float mass = 0.05f;
@@ -56,4 +105,82 @@ namespace sph_c {
     const glm::vec3 gravity(0.0f, -9.81f, 0.0f);
 
     const glm::vec4 box_color = glm::vec4(0.0, 0.0, 0.0, 0.2);
+
+    // Colliders are baked into a signed distance grid with this spacing (see sdf.h). The tank is
+    // the open box [-lim, lim] unless collider_mesh names an OBJ file: a closed mesh that is an
+    // obstacle inside the tank, or with collider_mesh_container the tank itself. Half of
+    // sprite_size puts the planes particles rest against on grid nodes, where lookups are exact.
+    const float sdf_spacing = 0.03125f;
+    const char* collider_mesh = "";
+    const bool collider_mesh_container = false;
+
+    // Spherical obstacle in the tank (radius 0 leaves it out)
+    const glm::vec3 obstacle_center(0.0f, -0.25f, 0.0f);
+    const float obstacle_radius = 0.0f;
+
+    const NeighborMode neighbor_mode = NeighborMode::lists;
+    const bool cache_pair_geometry = true;
+
+    // Verlet skin added to the search radius, neighbors are only rebuilt once a
+    // particle has moved more than half of it (0 rebuilds every step)
+    const float neighbor_skin = 0.0f;
+
+    // Use AVX2 / AVX-512 density and force kernels in lists mode when the CPU has them. WCSPH
+    // only runs them with symmetric_pairs off, the pair passes are scalar.
+    const bool simd_kernels = true;
+
+    // Steps between Morton (Z-order) sorts of the particle arrays, done on a neighbor
+    // rebuild so particles in the same cells sit together in memory (0 never reorders)
+    const int reorder_interval = 20;
+
+    // WCSPH density and force passes visit each pair once (j > i) and scatter the result to both
+    // particles through per-chunk buffers (n entries per pool thread), instead of evaluating every
+    // pair from both sides. The scalar pair passes are slower than the AVX2 per-particle ones,
+    // but the neighbor table they need is half as big: on the default tank a whole force
+    // evaluation, rebuild included, takes ~16 ms with pairs and ~19 ms per particle with AVX2.
+    const bool symmetric_pairs = true;
+
+    // WCSPH particles slower than sleep_velocity whose density changes by less than
+    // sleep_density_change (relative) per substep fall asleep after sleep_steps substeps and are
+    // skipped by the density, force and integration passes. Sleepers wake when a particle in a
+    // neighboring cell moves faster than wake_velocity (sleep_steps 0 keeps everyone awake).
+    const int sleep_steps = 20;
+    const float sleep_velocity = 0.05f;
+    const float sleep_density_change = 5e-3f;
+    const float wake_velocity = 0.2f;
+
+    // WCSPH adaptive resolution: every adapt_interval frames, interior particles merge pairwise up to
+    // adaptive_levels times and merged particles near the free surface split again. A particle
+    // of level l has 2^l times the mass and 2^(l/3) times the smoothing length, pairs use the
+    // smaller of both (0 turns it off, 3 is the most).
+    // Particles whose kernel-weighted neighbor centroid lies further than surface_offset * h_i
+    // away count as free surface.
+    const int adaptive_levels = 0;
+    const float surface_offset = 0.1f;
+    const int adapt_interval = 5;
+
+    // Substep size is the smallest of cfl_factor * h / (c + v_max), force_factor * sqrt(h / a_max)
+    // and viscosity_factor * h^2 rho0 / mu, clamped to [min_time_step, max_time_step]. Substeps
+    // don't stop at frame ends, one may cover several frames. Off by default: the default tank
+    // settles at several times rho0 (k is soft), its force limit stays near delta_time / 2 even
+    // at rest, so it would take about twice the fixed steps.
+    const bool adaptive_time_step = false;
+    const Integrator integrator = Integrator::symplectic_euler;
+    const float cfl_factor = 0.4f;
+    const float force_factor = 0.25f;
+    const float viscosity_factor = 0.125f;
+    const float min_time_step = 1e-4f;
+    const float max_time_step = 0.048f;
+
+    const Solver solver = Solver::wcsph;
+
+    // PBF: constraint iterations per substep, rest density (0 takes the densest particle of
+    // the initial lattice), lambda regularisation, tensile correction k * (W(r) / W(dq * h))^4
+    // and XSPH viscosity. PBF substeps only follow the CFL limit.
+    const int pbf_iterations = 4;
+    const float pbf_rest_density = 0.0f;
+    const float pbf_relaxation = 1.0f;
+    const float pbf_tensile_k = 1e-4f;
+    const float pbf_tensile_dq = 0.2f;
+    const float pbf_xsph = 0.01f;
 }
@@ -0,0 +1,326 @@
+#include "sph_simd.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SPH_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// The gathers below index straight into the packed xyz floats of glm::vec3 arrays
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 must be tightly packed");
+
+namespace sph_simd {
+
+static inline float poly6_term(const KernelParams& kp, const glm::vec3& xi, const glm::vec3& xj) {
+    const glm::vec3 r_v = xi - xj;
+    const float r2 = glm::dot(r_v, r_v);
+    if(r2 > kp.h2) { return 0.0f; }
+
+    const float d = kp.h2 - r2;
+    return d * d * d;
+}
+
+static inline void force_pair(const KernelParams& kp, const glm::vec3* pos, const glm::vec3* vel,
+                              const float* rho, const float* prs, size_t i, uint32_t j, ForceSums& out)
+{
+    if(rho[j] == 0.0f) { return; }
+
+    const glm::vec3 r_v = pos[i] - pos[j];
+    const float r2 = glm::dot(r_v, r_v);
+    if(r2 > kp.h2 || r2 == 0.0f) { return; }
+
+    const float r = std::sqrt(r2);
+    const float hr = kp.h - r;
+
+    out.pressure -= kp.mass * ((prs[i] + prs[j]) / (2 * rho[j])) * (kp.spikyGrad_const * hr * hr / r) * r_v;
+    out.viscosity += kp.mu * kp.mass * (vel[j] - vel[i]) / rho[j] * (kp.viscosityLaplace_const * hr);
+}
+
+static float density_scalar(const KernelParams& kp, const glm::vec3* pos, glm::vec3 xi,
+                            const uint32_t* idx, uint32_t count)
+{
+    float sum = 0.0f;
+    for(uint32_t n = 0; n < count; n++) { sum += poly6_term(kp, xi, pos[idx[n]]); }
+
+    return kp.mass * kp.poly6_const * sum;
+}
+
+static ForceSums force_scalar(const KernelParams& kp, const glm::vec3* pos, const glm::vec3* vel,
+                              const float* rho, const float* prs, size_t i,
+                              const uint32_t* idx, uint32_t count)
+{
+    ForceSums out {glm::vec3(0.0f), glm::vec3(0.0f)};
+    for(uint32_t n = 0; n < count; n++) { force_pair(kp, pos, vel, rho, prs, i, idx[n], out); }
+
+    return out;
+}
+
+#ifdef SPH_SIMD_X86
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static float density_avx2(const KernelParams& kp, const glm::vec3* pos, glm::vec3 xi,
+                          const uint32_t* idx, uint32_t count)
+{
+    const float* p = &pos[0].x;
+    const __m256 xi_x = _mm256_set1_ps(xi.x);
+    const __m256 xi_y = _mm256_set1_ps(xi.y);
+    const __m256 xi_z = _mm256_set1_ps(xi.z);
+    const __m256 h2 = _mm256_set1_ps(kp.h2);
+    const __m256i three = _mm256_set1_epi32(3);
+
+    __m256 acc = _mm256_setzero_ps();
+    uint32_t n = 0;
+    for(; n + 8 <= count; n += 8) {
+        const __m256i j3 = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*) (idx + n)), three);
+        const __m256 dx = _mm256_sub_ps(xi_x, _mm256_i32gather_ps(p, j3, 4));
+        const __m256 dy = _mm256_sub_ps(xi_y, _mm256_i32gather_ps(p + 1, j3, 4));
+        const __m256 dz = _mm256_sub_ps(xi_z, _mm256_i32gather_ps(p + 2, j3, 4));
+
+        const __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        const __m256 d = _mm256_sub_ps(h2, r2);
+        const __m256 w = _mm256_mul_ps(_mm256_mul_ps(d, d), d);
+
+        acc = _mm256_add_ps(acc, _mm256_and_ps(_mm256_cmp_ps(r2, h2, _CMP_LE_OQ), w));
+    }
+
+    float sum = hsum_avx2(acc);
+    for(; n < count; n++) { sum += poly6_term(kp, xi, pos[idx[n]]); }
+
+    return kp.mass * kp.poly6_const * sum;
+}
+
+__attribute__((target("avx2,fma")))
+static ForceSums force_avx2(const KernelParams& kp, const glm::vec3* pos, const glm::vec3* vel,
+                            const float* rho, const float* prs, size_t i,
+                            const uint32_t* idx, uint32_t count)
+{
+    const float* p = &pos[0].x;
+    const float* v = &vel[0].x;
+    const __m256 xi_x = _mm256_set1_ps(pos[i].x);
+    const __m256 xi_y = _mm256_set1_ps(pos[i].y);
+    const __m256 xi_z = _mm256_set1_ps(pos[i].z);
+    const __m256 vi_x = _mm256_set1_ps(vel[i].x);
+    const __m256 vi_y = _mm256_set1_ps(vel[i].y);
+    const __m256 vi_z = _mm256_set1_ps(vel[i].z);
+    const __m256 p_i = _mm256_set1_ps(prs[i]);
+
+    const __m256 h = _mm256_set1_ps(kp.h);
+    const __m256 h2 = _mm256_set1_ps(kp.h2);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 pressure_scale = _mm256_set1_ps(0.5f * kp.mass * kp.spikyGrad_const);
+    const __m256 viscosity_scale = _mm256_set1_ps(kp.mu * kp.mass * kp.viscosityLaplace_const);
+    const __m256i three = _mm256_set1_epi32(3);
+
+    __m256 fp_x = zero, fp_y = zero, fp_z = zero;
+    __m256 fv_x = zero, fv_y = zero, fv_z = zero;
+
+    uint32_t n = 0;
+    for(; n + 8 <= count; n += 8) {
+        const __m256i j = _mm256_loadu_si256((const __m256i*) (idx + n));
+        const __m256i j3 = _mm256_mullo_epi32(j, three);
+
+        const __m256 dx = _mm256_sub_ps(xi_x, _mm256_i32gather_ps(p, j3, 4));
+        const __m256 dy = _mm256_sub_ps(xi_y, _mm256_i32gather_ps(p + 1, j3, 4));
+        const __m256 dz = _mm256_sub_ps(xi_z, _mm256_i32gather_ps(p + 2, j3, 4));
+        const __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+        const __m256 rho_j = _mm256_i32gather_ps(rho, j, 4);
+        const __m256 p_j = _mm256_i32gather_ps(prs, j, 4);
+
+        const __m256 valid = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(r2, h2, _CMP_LE_OQ), _mm256_cmp_ps(r2, zero, _CMP_GT_OQ)),
+            _mm256_cmp_ps(rho_j, zero, _CMP_NEQ_OQ));
+
+        // Invalid lanes may hold inf/NaN here, the mask zeroes them before accumulation
+        const __m256 r = _mm256_sqrt_ps(r2);
+        const __m256 hr = _mm256_sub_ps(h, r);
+        const __m256 inv_rho = _mm256_div_ps(one, rho_j);
+
+        const __m256 cp = _mm256_and_ps(valid,
+            _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(pressure_scale, _mm256_add_ps(p_i, p_j)), inv_rho),
+                          _mm256_div_ps(_mm256_mul_ps(hr, hr), r)));
+        fp_x = _mm256_fnmadd_ps(cp, dx, fp_x);
+        fp_y = _mm256_fnmadd_ps(cp, dy, fp_y);
+        fp_z = _mm256_fnmadd_ps(cp, dz, fp_z);
+
+        const __m256 cv = _mm256_and_ps(valid, _mm256_mul_ps(_mm256_mul_ps(viscosity_scale, hr), inv_rho));
+        fv_x = _mm256_fmadd_ps(cv, _mm256_sub_ps(_mm256_i32gather_ps(v, j3, 4), vi_x), fv_x);
+        fv_y = _mm256_fmadd_ps(cv, _mm256_sub_ps(_mm256_i32gather_ps(v + 1, j3, 4), vi_y), fv_y);
+        fv_z = _mm256_fmadd_ps(cv, _mm256_sub_ps(_mm256_i32gather_ps(v + 2, j3, 4), vi_z), fv_z);
+    }
+
+    ForceSums out {
+        glm::vec3(hsum_avx2(fp_x), hsum_avx2(fp_y), hsum_avx2(fp_z)),
+        glm::vec3(hsum_avx2(fv_x), hsum_avx2(fv_y), hsum_avx2(fv_z))
+    };
+    for(; n < count; n++) { force_pair(kp, pos, vel, rho, prs, i, idx[n], out); }
+
+    return out;
+}
+
+// Masked with a zero source, the unmasked gather leaves its source uninitialized and GCC warns
+__attribute__((target("avx512f")))
+static inline __m512 gather16(__m512i index, const float* base) {
+    return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, index, base, 4);
+}
+
+// _mm512_reduce_add_ps and _mm512_castps512_ps256 extract halves from the same uninitialized source
+__attribute__((target("avx512f")))
+static inline float hsum_avx512(__m512 v) {
+    const __m512d d = _mm512_castps_pd(v);
+    const __m256 lo = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, d, 0));
+    const __m256 hi = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, d, 1));
+    return hsum_avx2(_mm256_add_ps(lo, hi));
+}
+
+__attribute__((target("avx512f")))
+static float density_avx512(const KernelParams& kp, const glm::vec3* pos, glm::vec3 xi,
+                            const uint32_t* idx, uint32_t count)
+{
+    const float* p = &pos[0].x;
+    const __m512 xi_x = _mm512_set1_ps(xi.x);
+    const __m512 xi_y = _mm512_set1_ps(xi.y);
+    const __m512 xi_z = _mm512_set1_ps(xi.z);
+    const __m512 h2 = _mm512_set1_ps(kp.h2);
+    const __m512i three = _mm512_set1_epi32(3);
+
+    __m512 acc = _mm512_setzero_ps();
+    uint32_t n = 0;
+    for(; n + 16 <= count; n += 16) {
+        const __m512i j3 = _mm512_mullo_epi32(_mm512_loadu_si512(idx + n), three);
+        const __m512 dx = _mm512_sub_ps(xi_x, gather16(j3, p));
+        const __m512 dy = _mm512_sub_ps(xi_y, gather16(j3, p + 1));
+        const __m512 dz = _mm512_sub_ps(xi_z, gather16(j3, p + 2));
+
+        const __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        const __m512 d = _mm512_sub_ps(h2, r2);
+        const __mmask16 inside = _mm512_cmp_ps_mask(r2, h2, _CMP_LE_OQ);
+
+        acc = _mm512_mask_add_ps(acc, inside, acc, _mm512_mul_ps(_mm512_mul_ps(d, d), d));
+    }
+
+    float sum = hsum_avx512(acc);
+    for(; n < count; n++) { sum += poly6_term(kp, xi, pos[idx[n]]); }
+
+    return kp.mass * kp.poly6_const * sum;
+}
+
+__attribute__((target("avx512f")))
+static ForceSums force_avx512(const KernelParams& kp, const glm::vec3* pos, const glm::vec3* vel,
+                              const float* rho, const float* prs, size_t i,
+                              const uint32_t* idx, uint32_t count)
+{
+    const float* p = &pos[0].x;
+    const float* v = &vel[0].x;
+    const __m512 xi_x = _mm512_set1_ps(pos[i].x);
+    const __m512 xi_y = _mm512_set1_ps(pos[i].y);
+    const __m512 xi_z = _mm512_set1_ps(pos[i].z);
+    const __m512 vi_x = _mm512_set1_ps(vel[i].x);
+    const __m512 vi_y = _mm512_set1_ps(vel[i].y);
+    const __m512 vi_z = _mm512_set1_ps(vel[i].z);
+    const __m512 p_i = _mm512_set1_ps(prs[i]);
+
+    const __m512 h = _mm512_set1_ps(kp.h);
+    const __m512 h2 = _mm512_set1_ps(kp.h2);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 pressure_scale = _mm512_set1_ps(0.5f * kp.mass * kp.spikyGrad_const);
+    const __m512 viscosity_scale = _mm512_set1_ps(kp.mu * kp.mass * kp.viscosityLaplace_const);
+    const __m512i three = _mm512_set1_epi32(3);
+
+    __m512 fp_x = zero, fp_y = zero, fp_z = zero;
+    __m512 fv_x = zero, fv_y = zero, fv_z = zero;
+
+    uint32_t n = 0;
+    for(; n + 16 <= count; n += 16) {
+        const __m512i j = _mm512_loadu_si512(idx + n);
+        const __m512i j3 = _mm512_mullo_epi32(j, three);
+
+        const __m512 dx = _mm512_sub_ps(xi_x, gather16(j3, p));
+        const __m512 dy = _mm512_sub_ps(xi_y, gather16(j3, p + 1));
+        const __m512 dz = _mm512_sub_ps(xi_z, gather16(j3, p + 2));
+        const __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+        const __m512 rho_j = gather16(j, rho);
+        const __m512 p_j = gather16(j, prs);
+
+        const __mmask16 valid = _mm512_cmp_ps_mask(r2, h2, _CMP_LE_OQ)
+                              & _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ)
+                              & _mm512_cmp_ps_mask(rho_j, zero, _CMP_NEQ_OQ);
+        if(!valid) { continue; }
+
+        const __m512 r = _mm512_maskz_sqrt_ps(valid, r2);
+        const __m512 hr = _mm512_sub_ps(h, r);
+        const __m512 inv_rho = _mm512_maskz_div_ps(valid, _mm512_set1_ps(1.0f), rho_j);
+
+        const __m512 cp = _mm512_maskz_mul_ps(valid,
+            _mm512_mul_ps(_mm512_mul_ps(pressure_scale, _mm512_add_ps(p_i, p_j)), inv_rho),
+            _mm512_maskz_div_ps(valid, _mm512_mul_ps(hr, hr), r));
+        fp_x = _mm512_fnmadd_ps(cp, dx, fp_x);
+        fp_y = _mm512_fnmadd_ps(cp, dy, fp_y);
+        fp_z = _mm512_fnmadd_ps(cp, dz, fp_z);
+
+        const __m512 cv = _mm512_maskz_mul_ps(valid, _mm512_mul_ps(viscosity_scale, hr), inv_rho);
+        fv_x = _mm512_fmadd_ps(cv, _mm512_sub_ps(gather16(j3, v), vi_x), fv_x);
+        fv_y = _mm512_fmadd_ps(cv, _mm512_sub_ps(gather16(j3, v + 1), vi_y), fv_y);
+        fv_z = _mm512_fmadd_ps(cv, _mm512_sub_ps(gather16(j3, v + 2), vi_z), fv_z);
+    }
+
+    ForceSums out {
+        glm::vec3(hsum_avx512(fp_x), hsum_avx512(fp_y), hsum_avx512(fp_z)),
+        glm::vec3(hsum_avx512(fv_x), hsum_avx512(fv_y), hsum_avx512(fv_z))
+    };
+    for(; n < count; n++) { force_pair(kp, pos, vel, rho, prs, i, idx[n], out); }
+
+    return out;
+}
+
+#endif
+
+Isa detect() {
+#ifdef SPH_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) { return Isa::avx512; }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return Isa::avx2; }
+#endif
+
+    return Isa::scalar;
+}
+
+const char* name(Isa isa) {
+    switch(isa) {
+        case Isa::avx2: return "avx2";
+        case Isa::avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+DensityFn density_kernel(Isa isa) {
+#ifdef SPH_SIMD_X86
+    if(isa == Isa::avx512) { return density_avx512; }
+    if(isa == Isa::avx2) { return density_avx2; }
+#endif
+
+    return density_scalar;
+}
+
+ForceFn force_kernel(Isa isa) {
+#ifdef SPH_SIMD_X86
+    if(isa == Isa::avx512) { return force_avx512; }
+    if(isa == Isa::avx2) { return force_avx2; }
+#endif
+
+    return force_scalar;
+}
+
+}
@@ -0,0 +1,170 @@
+#include "thread_pool.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static void pin_to_cpus(std::thread::native_handle_type handle, const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) { CPU_SET(cpu, &set); }
+    if(pthread_setaffinity_np(handle, sizeof(cpu_set_t), &set) != 0) {
+        std::cerr << "Could not pin thread to cpu " << cpus.front() << std::endl;
+    }
+#else
+    (void) handle;
+    (void) cpus;
+#endif
+}
+
+// CPUs of every NUMA node from sysfs, a single node holding every CPU when there is none
+static std::vector<std::vector<int>> numa_topology(int hardware) {
+    std::vector<std::vector<int>> nodes;
+
+#ifdef __linux__
+    for(int node = 0; ; node++) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!in) { break; }
+
+        // Comma separated CPUs and ranges, e.g. 0-15,32-47
+        std::vector<int> cpus;
+        std::string range;
+        while(std::getline(in, range, ',')) {
+            int first = 0;
+            int last = 0;
+            char dash = 0;
+            std::istringstream parse(range);
+            if(!(parse >> first)) { continue; }
+            last = (parse >> dash >> last) ? last : first;
+            for(int cpu = first; cpu <= last; cpu++) { cpus.push_back(cpu); }
+        }
+        if(!cpus.empty()) { nodes.push_back(cpus); }
+    }
+#endif
+
+    if(nodes.empty()) {
+        nodes.emplace_back();
+        for(int cpu = 0; cpu < hardware; cpu++) { nodes[0].push_back(cpu); }
+    }
+    return nodes;
+}
+
+ThreadPool::ThreadPool(int count, bool pin_threads, bool numa_aware)
+    : static_chunks(numa_aware), node_count(1), current_job(nullptr), generation(0), stopping(false) {
+    int hardware = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = (count > 0) ? count : hardware;
+    thread_node.assign(thread_count, 0);
+
+    // Consecutive threads share a node, so consecutive chunks (and particles) do too
+    std::vector<std::vector<int>> node_cpus;
+    if(numa_aware) {
+        node_cpus = numa_topology(hardware);
+        node_count = std::min<int>(node_cpus.size(), thread_count);
+        for(int i = 0; i < thread_count; i++) { thread_node[i] = i * node_count / thread_count; }
+    }
+
+    const auto pin = [&](std::thread::native_handle_type handle, int i) {
+        if(numa_aware) { pin_to_cpus(handle, node_cpus[thread_node[i]]); }
+        else if(pin_threads) { pin_to_cpus(handle, {i % hardware}); }
+    };
+
+    // The calling thread works on chunk 0, so only thread_count - 1 workers are spawned. Static
+    // chunks are the exception: whichever thread submits a job, chunk 0 has to run on node 0, so
+    // a pinned worker takes it and the caller only waits.
+    for(int i = static_chunks ? 0 : 1; i < thread_count; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+        pin(workers.back().native_handle(), i);
+    }
+
+#ifdef __linux__
+    if(!static_chunks) { pin(pthread_self(), 0); }
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_cv.notify_all();
+
+    for(auto& t: workers) { t.join(); }
+}
+
+void ThreadPool::run_chunks(Job& job, int index) {
+    const auto run = [&](size_t chunk) {
+        size_t begin = chunk * job.chunk_size;
+        size_t end = std::min(begin + job.chunk_size, job.total);
+
+        job.run(job.ctx, chunk, begin, end);
+
+        if(job.remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done_cv.notify_all();
+        }
+    };
+
+    if(static_chunks) {
+        if(static_cast<size_t>(index) < job.chunks) { run(index); }
+        return;
+    }
+
+    size_t chunk;
+    while((chunk = job.next.fetch_add(1)) < job.chunks) { run(chunk); }
+}
+
+void ThreadPool::worker_loop(int index) {
+    uint64_t seen = 0;
+
+    while(true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_cv.wait(lock, [&] { return stopping || (current_job && generation != seen); });
+            if(stopping) { return; }
+
+            seen = generation;
+            job = current_job;
+            job->users++;
+        }
+
+        run_chunks(*job, index);
+
+        if(job->users.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done_cv.notify_all();
+        }
+    }
+}
+
+void ThreadPool::execute(Job& job) {
+    std::lock_guard<std::mutex> submit(submit_mutex);
+
+    job.next = 0;
+    job.remaining = job.chunks;
+
+    if(static_chunks || job.chunks > 1) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current_job = &job;
+            generation++;
+        }
+        job_cv.notify_all();
+    }
+
+    if(!static_chunks) { run_chunks(job, 0); }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&] { return job.remaining == 0; });
+
+    // Workers still holding the job may touch its counters, wait for them before it leaves scope
+    current_job = nullptr;
+    done_cv.wait(lock, [&] { return job.users == 0; });
+}
@@ -0,0 +1,171 @@
+// Checks the AVX2 and AVX-512 density and force kernels, for every instruction set this CPU
+// runs: against their scalar versions on random neighbor sets, and inside the solver against
+// its scalar density and force passes, which go through the smoothing kernel policy instead.
+// Exits non-zero on a mismatch.
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "batch.h"
+#include "sph_simd.h"
+
+using namespace sph_simd;
+
+static constexpr float tolerance = 1e-4f;
+
+// Relative error against the reference, with a floor for sums that cancel to near zero
+static bool close(float value, float reference, float scale) {
+    return std::abs(value - reference) <= tolerance * std::max(std::abs(reference), scale);
+}
+
+static bool close(const glm::vec3& value, const glm::vec3& reference, float scale) {
+    return close(value.x, reference.x, scale) && close(value.y, reference.y, scale) && close(value.z, reference.z, scale);
+}
+
+// Mismatching neighbor sets
+static int check_kernels() {
+    const float h = 0.1f;
+    const float pi = 3.14159265358979f;
+    const KernelParams kp {h, h * h, 0.05f, 3.5f, 315.0f / (64.0f * pi * std::pow(h, 9.0f)),
+                           -45.0f / (pi * std::pow(h, 6.0f)), 45.0f / (pi * std::pow(h, 6.0f))};
+
+    // Particles in a box a few h wide, so lists mix pairs inside and outside the kernel radius
+    const size_t n = 4096;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(0.0f, 3.0f * h);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> density(900.0f, 1100.0f);
+    std::uniform_int_distribution<uint32_t> index(0, n - 1);
+
+    std::vector<glm::vec3> pos(n), vel(n);
+    std::vector<float> rho(n), prs(n);
+    for(size_t i = 0; i < n; i++) {
+        pos[i] = glm::vec3(coord(rng), coord(rng), coord(rng));
+        vel[i] = glm::vec3(unit(rng), unit(rng), unit(rng));
+        rho[i] = (i % 97 == 0) ? 0.0f : density(rng);   // rho_j = 0 pairs are skipped
+        prs[i] = 3.0f * (rho[i] - 1000.0f);
+    }
+
+    const DensityFn density_ref = density_kernel(Isa::scalar);
+    const ForceFn force_ref = force_kernel(Isa::scalar);
+
+    int failures = 0;
+    const Isa best = detect();
+    for(Isa isa: {Isa::scalar, Isa::avx2, Isa::avx512}) {
+        if(static_cast<int>(isa) > static_cast<int>(best)) { break; }
+
+        const DensityFn density_fn = density_kernel(isa);
+        const ForceFn force_fn = force_kernel(isa);
+        int checked = 0;
+
+        for(int trial = 0; trial < 2000; trial++) {
+            // Lengths around and between the vector widths exercise the scalar tails
+            const size_t i = index(rng);
+            std::vector<uint32_t> idx(trial % 67);
+            for(uint32_t& j: idx) { j = index(rng); }
+            if(!idx.empty() && trial % 5 == 0) { idx[0] = static_cast<uint32_t>(i); }    // r = 0
+
+            const uint32_t count = static_cast<uint32_t>(idx.size());
+            const float d_ref = density_ref(kp, pos.data(), pos[i], idx.data(), count);
+            const float d = density_fn(kp, pos.data(), pos[i], idx.data(), count);
+            const ForceSums f_ref = force_ref(kp, pos.data(), vel.data(), rho.data(), prs.data(), i, idx.data(), count);
+            const ForceSums f = force_fn(kp, pos.data(), vel.data(), rho.data(), prs.data(), i, idx.data(), count);
+
+            // Floors for sums that cancel: a pair's density, a hundredth of a pair's force
+            const float d_scale = kp.mass * kp.poly6_const * std::pow(kp.h2, 3.0f);
+            const float f_scale = std::abs(kp.mass * kp.spikyGrad_const * h * h) * 1e-2f;
+
+            if(!close(d, d_ref, d_scale) || !close(f.pressure, f_ref.pressure, f_scale) ||
+               !close(f.viscosity, f_ref.viscosity, f_scale)) {
+                if(failures++ < 10) {
+                    std::cerr << name(isa) << ": mismatch for particle " << i << " with " << count << " neighbors, density "
+                              << d << " vs " << d_ref << std::endl;
+                }
+            }
+            checked++;
+        }
+
+        std::cout << name(isa) << ": " << checked << " neighbor sets checked" << std::endl;
+    }
+
+    return failures;
+}
+
+// Mismatching particles of one density and one force pass of the solver, on the default tank
+// some frames into its splash. Both passes get the scalar pass's densities and pressures, so a
+// force mismatch isn't just a density one carried over.
+static int check_solver() {
+    if(!SelectedKernel::batched_simd) {
+        std::cout << "solver: skipped, the batched kernels are Müller's and the solver runs " << SelectedKernel::name << std::endl;
+        return 0;
+    }
+
+    ThreadPool pool(4);
+    Scene scene {pool, "wcsph", false};
+    Simulation& sph = scene.sph;
+    for(int frame = 0; frame < 40; frame++) { sph.advance_frame(); }
+
+    // The per-particle passes, every particle of them
+    sph.symmetric_pairs = false;
+    sph.wake_all();
+    ParticleStore& p = sph.particles;
+    const size_t n = p.size();
+
+    sph.set_simd_isa(Isa::scalar);
+    sph.update_neighbors();
+    sph.parallel(&Simulation::update_properties);
+    sph.parallel(&Simulation::calculate_forces);
+    const std::vector<float> rho_ref(p.densities.begin(), p.densities.end());
+    const std::vector<float> prs_ref(p.pressures.begin(), p.pressures.end());
+    const std::vector<glm::vec3> acc_ref(p.accelerations.begin(), p.accelerations.end());
+
+    // Floors as above: a pair's density, a hundredth of a pair's acceleration at rest density
+    const KernelCoeffs& c = sph.kernel;
+    const float d_scale = sph.mass * c.w * std::pow(sph.h * sph.h, 3.0f);
+    const float a_scale = std::abs(sph.mass * c.grad * sph.h * sph.h) * 1e-2f;
+
+    int failures = 0;
+    const Isa best = detect();
+    for(Isa isa: {Isa::avx2, Isa::avx512}) {
+        if(static_cast<int>(isa) > static_cast<int>(best)) { break; }
+
+        sph.set_simd_isa(isa);
+        sph.update_neighbors();
+        sph.parallel(&Simulation::update_properties);
+        for(size_t i = 0; i < n; i++) {
+            if(close(p.densities[i], rho_ref[i], d_scale)) { continue; }
+            if(failures++ < 10) {
+                std::cerr << "solver, " << name(isa) << ": density of particle " << i << " is " << p.densities[i]
+                          << ", scalar pass " << rho_ref[i] << std::endl;
+            }
+        }
+
+        std::copy(rho_ref.begin(), rho_ref.end(), p.densities.begin());
+        std::copy(prs_ref.begin(), prs_ref.end(), p.pressures.begin());
+        sph.parallel(&Simulation::calculate_forces);
+        for(size_t i = 0; i < n; i++) {
+            if(close(p.accelerations[i], acc_ref[i], a_scale)) { continue; }
+            if(failures++ < 10) {
+                const glm::vec3& a = p.accelerations[i];
+                std::cerr << "solver, " << name(isa) << ": acceleration of particle " << i << " is (" << a.x << ", " << a.y
+                          << ", " << a.z << "), scalar pass (" << acc_ref[i].x << ", " << acc_ref[i].y << ", " << acc_ref[i].z
+                          << ")" << std::endl;
+            }
+        }
+
+        std::cout << "solver, " << name(isa) << ": " << n << " particles checked" << std::endl;
+    }
+
+    return failures;
+}
+
+int main() {
+    const int failures = check_kernels() + check_solver();
+    if(failures > 0) {
+        std::cerr << failures << " mismatches" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Steps the default scene for main_c::alloc_warmup_frames frames, then checks that neither the
+// simulation step nor marching cubes touches the heap in the frames after. Exits non-zero when
+// one does.
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "alloc_counter.h"
+#include "batch.h"
+#include "sph_consts.h"
+
+using namespace main_c;
+
+static constexpr int checked_frames = 30;
+
+// Frames in which a phase allocated. The mesh lattice is 4 times coarser than the default one,
+// which costs seconds per frame, the code paths are the same.
+static int run(ThreadPool& pool, const std::string& solver, bool marching_cubes) {
+    Scene scene {pool, solver, false};
+    if(marching_cubes) {
+        scene.cm.reset(new SurfaceMesh{2*lim_x, 2*lim_y, 2*lim_z, 4 * len_cube, cm_h, scene.sph.particles, scene.sph.mass,
+                                       iso_value, scene.search, pool});
+        scene.cm->neighbor_mode = scene.sph.neighbor_mode;
+    }
+
+    const int warmup = std::max(alloc_warmup_frames, 0);
+    int failures = 0;
+
+    for(int frame = 0; frame < warmup + checked_frames; frame++) {
+        const uint64_t before = alloc_counter::count();
+        step_frame(scene, nullptr, frame, /*alloc_checks=*/false);
+        const uint64_t after_step = alloc_counter::count();
+        if(scene.cm) { scene.cm->MarchingCubes(); }
+        const uint64_t after_mesh = alloc_counter::count();
+
+        if(frame < warmup) { continue; }
+        if(after_step != before) {
+            std::cerr << solver << ": simulation step made " << after_step - before << " heap allocations in frame " << frame << std::endl;
+            failures++;
+        }
+        if(after_mesh != after_step) {
+            std::cerr << solver << ": marching cubes made " << after_mesh - after_step << " heap allocations in frame " << frame << std::endl;
+            failures++;
+        }
+    }
+
+    std::cout << solver << (marching_cubes ? " with marching cubes: " : ": ") << checked_frames << " frames checked after "
+              << warmup << " warm-up frames" << std::endl;
+    return failures;
+}
+
+int main() {
+    // More chunks than most CI machines have cores, so the per-chunk buffers are exercised
+    ThreadPool pool(4);
+
+    const int failures = run(pool, "wcsph", true) + run(pool, "pbf", false);
+    if(failures > 0) {
+        std::cerr << failures << " allocating phases" << std::endl;
+        return 1;
+    }
+    return 0;
+}